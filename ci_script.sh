@@ -2,6 +2,10 @@
 
 set -x -e -v
 
+echo "- Host tests"
+make -C tests
+make -C tests build/bench
+
 for board in d1_mini ; do
     echo "- Building for $board"
     env PLATFORMIO_CI_SRC=examples/basic/ \
@@ -16,5 +20,83 @@ for board in d1_mini ; do
         pio ci --board=$board --lib="."
     env PLATFORMIO_CI_SRC=examples/enterpise PLATFORMIO_BUILD_FLAGS='-DJUSTWIFI_ENABLE_ENTERPRISE' \
         pio ci --board=$board --lib="."
+    env PLATFORMIO_CI_SRC=examples/cycle \
+        pio ci --board=$board --lib="."
+done
+
+for board in esp32dev ; do
+    echo "- Building for $board"
+    env PLATFORMIO_CI_SRC=examples/basic/ \
+        pio ci --board=$board --lib="."
+    env PLATFORMIO_CI_SRC=examples/advanced \
+        pio ci --board=$board --lib="."
+    env PLATFORMIO_CI_SRC=examples/ap \
+        pio ci --board=$board --lib="."
+    env PLATFORMIO_CI_SRC=examples/smartconfig PLATFORMIO_BUILD_FLAGS='-DJUSTWIFI_ENABLE_SMARTCONFIG' \
+        pio ci --board=$board --lib="."
+    env PLATFORMIO_CI_SRC=examples/enterpise PLATFORMIO_BUILD_FLAGS='-DJUSTWIFI_ENABLE_ENTERPRISE' \
+        pio ci --board=$board --lib="."
+    env PLATFORMIO_CI_SRC=examples/cycle \
+        pio ci --board=$board --lib="."
 done
 
+
+# Footprint of every feature configuration, compared with the plain build.
+# Budgets are bytes the configuration may add on top of it (IRAM, DRAM, flash)
+SIZE=${SIZE:-$HOME/.platformio/packages/toolchain-xtensa/bin/xtensa-lx106-elf-size}
+
+# Prints "iram dram flash", fails when the build or the size tool does.
+# Runs in a command substitution, so errors have to be returned and checked by the caller
+footprint() {
+    local dir elf sections status
+    dir=$(mktemp -d)
+    env PLATFORMIO_CI_SRC=examples/footprint PLATFORMIO_BUILD_FLAGS="$1" \
+        pio ci --board=d1_mini --lib="." --keep-build-dir --build-dir="$dir" > /dev/null < /dev/null
+    status=$?
+    if [ $status -eq 0 ] ; then
+        elf=$(find "$dir" -name firmware.elf | head -n 1)
+        sections=$($SIZE -A "$elf")
+        status=$?
+    fi
+    rm -rf "$dir"
+    [ $status -eq 0 ] || return $status
+    awk '
+        $1 == ".text" || $1 == ".iram0.text" { iram += $2 }
+        $1 == ".data" || $1 == ".rodata" || $1 == ".bss" { dram += $2 }
+        $1 == ".irom0.text" || $1 == ".text" || $1 == ".data" || $1 == ".rodata" { flash += $2 }
+        END { if (flash) print iram, dram, flash }' <<< "$sections"
+}
+
+# Stops the script with the configuration name when there is nothing to compare
+measure() {
+    local out
+    if ! out=$(footprint "$2") || [ -z "$out" ] ; then
+        echo "- $1 footprint build failed" >&2
+        exit 1
+    fi
+    echo "$out"
+}
+
+base=$(measure base '') || exit 1
+read base_iram base_dram base_flash <<< "$base"
+echo "{\"config\":\"base\",\"iram\":$base_iram,\"dram\":$base_dram,\"flash\":$base_flash}"
+
+over=0
+while read name flags iram_budget dram_budget flash_budget ; do
+    sizes=$(measure "$name" "$flags") || exit 1
+    read iram dram flash <<< "$sizes"
+    iram=$((iram - base_iram)) dram=$((dram - base_dram)) flash=$((flash - base_flash))
+    echo "{\"config\":\"$name\",\"iram\":$iram,\"dram\":$dram,\"flash\":$flash}"
+    if [ $iram -gt $iram_budget ] || [ $dram -gt $dram_budget ] || [ $flash -gt $flash_budget ] ; then
+        echo "- $name is over budget ($iram_budget, $dram_budget, $flash_budget)"
+        over=1
+    fi
+done <<'BUDGET'
+wps -DJUSTWIFI_ENABLE_WPS 1024 2048 32768
+smartconfig -DJUSTWIFI_ENABLE_SMARTCONFIG 1024 2048 16384
+enterprise -DJUSTWIFI_ENABLE_ENTERPRISE 1024 2048 65536
+profile -DJUSTWIFI_ENABLE_PROFILE 256 256 4096
+notrace -DJUSTWIFI_TRACE_SIZE=0 0 0 0
+BUDGET
+
+exit $over
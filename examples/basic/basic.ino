@@ -50,7 +50,7 @@ void setup() {
     // Enable STA mode (connecting to a router)
     jw.enableSTA(true);
 
-    // Configure it to scan available networks and connect in order of dBm
+    // Configure it to scan available networks and connect in order of signal strength and reliability
     jw.enableScan(true);
 
     // Clean existing network configuration
@@ -0,0 +1,75 @@
+/*
+
+JustWifi - Duty cycle example
+
+Wakes up, connects, sends a single packet and goes back to deep sleep.
+On ESP8266 connect GPIO16 to RST so the timer can wake the chip up
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <JustWifi.h>
+#include <WiFiUdp.h>
+
+#define SLEEP_US            (60 * 1000000ull)
+#define REPORT_HOST         "192.168.1.10"
+#define REPORT_PORT         5000
+
+WiFiUDP udp;
+
+// endPacket() only queues the packet, the radio is kept on for JUSTWIFI_CYCLE_FLUSH ms
+// afterwards so it goes out before deep sleep
+void send() {
+    const auto& last = jw.getLastCycle();
+    udp.beginPacket(REPORT_HOST, REPORT_PORT);
+    udp.printf(
+        "{\"awake\":%u,\"ready\":%u,\"fast\":%u}",
+        last.awake, last.ready, last.fast
+    );
+    udp.endPacket();
+}
+
+void infoCallback(justwifi_messages_t code, char * parameter) {
+    if (code == MESSAGE_CYCLE_SLEEP) {
+        Serial.printf("[WIFI] Going to sleep %s\n", parameter);
+        Serial.flush();
+    }
+}
+
+void setup() {
+
+    Serial.begin(115200);
+    Serial.println();
+
+    // -------------------------------------------------------------------------
+    jw.begin();
+    jw.subscribe(infoCallback);
+
+    jw.enableAP(false);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+
+    jw.addNetwork("home", "password");
+
+    // Previous wake is reported by this one, the current one is only known right before sleeping
+    jw.startCycle(send, SLEEP_US);
+
+}
+
+void loop() {
+    jw.loop();
+}
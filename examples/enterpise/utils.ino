@@ -119,6 +119,7 @@ void infoCallback(justwifi_messages_t code, char * parameter) {
     // -------------------------------------------------------------------------
 
     if (code == MESSAGE_ACCESSPOINT_CREATED) {
+        Serial.printf("[WIFI] Access point created %s\n", parameter);
         infoWifi();
     }
 
@@ -134,6 +135,26 @@ void infoCallback(justwifi_messages_t code, char * parameter) {
         Serial.printf("[WIFI] Could not create access point\n");
     }
 
+    if (code == MESSAGE_ACCESSPOINT_CHANNEL_CHANGE) {
+        Serial.printf("[WIFI] Access point channel change %s\n", parameter);
+    }
+
+    if (code == MESSAGE_GATEWAY_UNREACHABLE) {
+        Serial.printf("[WIFI] Gateway unreachable %s\n", parameter);
+    }
+
+    if (code == MESSAGE_NETWORK_READY) {
+        Serial.printf("[WIFI] Network ready %s\n", parameter);
+    }
+
+    if (code == MESSAGE_CYCLE_SLEEP) {
+        Serial.printf("[WIFI] Going to sleep %s\n", parameter);
+    }
+
+    if (code == MESSAGE_CHANNEL_CHANGE) {
+        Serial.printf("[WIFI] Changing channel %s\n", parameter);
+    }
+
     // ------------------------------------------------------------------------
 
     if (code == MESSAGE_WPS_START) {
@@ -0,0 +1,70 @@
+/*
+
+JustWifi - Footprint example
+
+This example is built by ci_script.sh with every feature flag to measure the
+library size. When running, it reports the heap used while scanning and connecting
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <JustWifi.h>
+
+#define REPORT_INTERVAL     10000
+
+void setup() {
+
+    Serial.begin(115200);
+    delay(2000);
+    Serial.println();
+    Serial.println();
+
+    // -------------------------------------------------------------------------
+    jw.begin();
+
+    jw.enableAP(false);
+    jw.enableAPFallback(false);
+    jw.enableSTA(true);
+    jw.enableScan(true);
+
+    jw.cleanNetworks();
+    jw.addNetwork("home", "password");
+
+    // -------------------------------------------------------------------------
+
+    Serial.println("[WIFI] Connecting Wifi...");
+
+}
+
+void loop() {
+
+    jw.loop();
+
+    // One JSON object per line, so it can be collected from the serial port
+    static unsigned long last = 0;
+    if (millis() - last > REPORT_INTERVAL) {
+        last = millis();
+        const auto& heap = jw.getHeap();
+        Serial.printf(
+            "{\"idle\":%u,\"scan\":%u,\"connect\":%u,\"loop_max\":%lu}\n",
+            heap.idle, heap.scan, heap.connect, jw.getLoopMax()
+        );
+    }
+
+    delay(10);
+
+}
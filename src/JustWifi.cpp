@@ -21,32 +21,46 @@ along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "JustWifi.h"
 
-#include <user_interface.h>
 #include <cstring>
+#include <new>
 
-// -----------------------------------------------------------------------------
-// WPA2E support (no support from Arduino Core WiFi, needs manual SDK calls!)
-// -----------------------------------------------------------------------------
+namespace backend = justwifi::backend;
 
-#ifdef JUSTWIFI_ENABLE_ENTERPRISE
+#if JUSTWIFI_ENABLE_PROFILE
 
-#include <wpa2_enterprise.h>
+namespace {
 
-#endif
+struct Profile {
 
-// -----------------------------------------------------------------------------
-// WPS callbacks
-// -----------------------------------------------------------------------------
+    Profile(justwifi_profile_t& profile) :
+        _profile(profile),
+        _allocations(backend::allocations()),
+        _start(backend::cycles())
+    {}
 
-#if defined(JUSTWIFI_ENABLE_WPS)
+    ~Profile() {
+        uint32_t cycles = backend::cycles() - _start;
+        ++_profile.calls;
+        _profile.cycles += cycles;
+        if (cycles > _profile.max) _profile.max = cycles;
+        _profile.allocations += backend::allocations() - _allocations;
+    }
 
-static wps_cb_status _jw_wps_status;
+    justwifi_profile_t& _profile;
+    uint32_t _allocations;
+    uint32_t _start;
 
-void _jw_wps_status_cb(wps_cb_status status) {
-    _jw_wps_status = status;
-}
+};
 
-#endif // defined(JUSTWIFI_ENABLE_WPS)
+} // namespace
+
+#define JUSTWIFI_PROFILE(POINT) Profile _profile_scope(_profile[POINT])
+
+#else
+
+#define JUSTWIFI_PROFILE(POINT)
+
+#endif
 
 //------------------------------------------------------------------------------
 // CONSTRUCTOR
@@ -55,39 +69,246 @@ void _jw_wps_status_cb(wps_cb_status status) {
 JustWifi::JustWifi() {
     _softap.ssid = nullptr;
     _timeout = 0;
-    snprintf_P(_hostname, sizeof(_hostname), PSTR("ESP-%06X"), ESP.getChipId());
+    snprintf_P(_hostname, sizeof(_hostname), PSTR("ESP-%06X"), backend::chipId());
 }
 
 JustWifi::~JustWifi() {
-    cleanNetworks();
+    command_t command;
+    while (_commands.pop(command)) {
+        _freeCommand(command);
+    }
+    _callbacks.clear();
+    _cleanNetworks();
 }
 
 void JustWifi::begin() {
-    WiFi.persistent(false);
-    WiFi.enableAP(false);
-    WiFi.enableSTA(false);
+    backend::persistent(false);
+    backend::enableAP(false);
+    backend::enableSTA(false);
+    backend::setEventHandler(_onEvent, this);
+    _power_tick = millis();
+}
+
+// Called from the SDK context, only store the reason and process it in loop()
+void JustWifi::_onEvent(void* arg, backend::Event event, uint8_t reason) {
+    auto* self = static_cast<JustWifi*>(arg);
+    if (backend::Event::StationDisconnected == event) {
+        self->_disconnected_reason = reason;
+    }
+    backend::taskNotify();
 }
 
 //------------------------------------------------------------------------------
 // PRIVATE METHODS
 //------------------------------------------------------------------------------
 
-void JustWifi::_disable() {
+bool JustWifi::_apCoexists() {
+    return _ap_coexistence && _ap_connected;
+}
+
+bool JustWifi::_useScan() {
+    return _scan || _channel_lock;
+}
+
+bool JustWifi::_channelAllowed(uint8_t channel) {
+    if (!_channel_lock) return true;
+    return (channel >= 1) && (channel <= JUSTWIFI_CHANNELS) && (_channel_lock & JUSTWIFI_CHANNEL(channel));
+}
+
+// Networks on unknown or other channels can't be joined while locked
+bool JustWifi::_lockAllows(uint8_t id) {
+    if (!_channel_lock) return true;
+    return _channelAllowed(_network_list[id].channel);
+}
+
+// Next channel to scan after the given one, 0 when there are no more
+uint8_t JustWifi::_nextChannel(uint8_t channel) {
+    const uint8_t last = _channel_lock ? JUSTWIFI_CHANNELS : JUSTWIFI_SCAN_CHANNEL_MAX;
+    while (++channel <= last) {
+        if (_channelAllowed(channel)) return channel;
+    }
+    return 0;
+}
+
+void JustWifi::_channelChange(uint8_t from, uint8_t to, uint8_t id) {
+    char buffer[32];
+    snprintf_P(buffer, sizeof(buffer), PSTR("CH: %u -> %u"), from, to);
+    _trace(MESSAGE_CHANNEL_CHANGE, id, 0, to);
+    _doCallback(MESSAGE_CHANNEL_CHANGE, buffer);
+}
+
+// Leave the channels that are no longer allowed right away, instead of on the next reconnect
+void JustWifi::_lockChannels(uint16_t channels) {
+
+    _channel_lock = channels;
+    if (!_channel_lock) return;
+
+    const uint8_t first = _nextChannel(0);
+
+    uint8_t current = backend::channel();
+    if (_sta_session && (_stats_id < _network_list.size()) && !_channelAllowed(current)) {
+        _channelChange(current, first, _stats_id);
+        _dropNetwork(_stats_id);
+    } else if (((STATE_STA_START == _state) || (STATE_STA_ONGOING == _state))
+        && (_currentID < _network_list.size()) && !_channelAllowed(_network_list[_currentID].channel)) {
+        _dropNetwork(_currentID);
+    }
+
+    current = backend::softAPChannel();
+    if (_ap_connected && current && !_channelAllowed(current)) {
+        _channelChange(current, first, JUSTWIFI_TRACE_NO_NETWORK);
+        _enableAP(false);
+        _enableAP(true);
+    }
+
+}
+
+bool JustWifi::_apChannelAllowed(uint8_t id) {
+
+    if (!_apCoexists()) return true;
+
+    auto& entry = _network_list[id];
+    uint8_t channel = backend::softAPChannel();
+    if (!entry.channel || !channel || (entry.channel == channel)) return true;
+
+    // Don't pull connected clients off the current channel
+    if (backend::softAPStations() > 0) return false;
+
+    char buffer[32];
+    snprintf_P(buffer, sizeof(buffer), PSTR("CH: %u -> %u"), channel, entry.channel);
+    _trace(MESSAGE_ACCESSPOINT_CHANNEL_CHANGE, id, entry.rssi, entry.channel);
+    _doCallback(MESSAGE_ACCESSPOINT_CHANNEL_CHANGE, buffer);
+
+    return true;
+
+}
+
+// Every network adds its signal above the noise floor to its own channel
+// and a part of it to the overlapping ones (20MHz wide channels are 5 apart)
+void JustWifi::_countChannel(int32_t channel, int32_t rssi) {
+
+    if ((channel < 1) || (channel > JUSTWIFI_CHANNELS)) return;
+
+    if (_channel_networks[channel - 1] < UINT8_MAX) {
+        ++_channel_networks[channel - 1];
+    }
+
+    int32_t weight = std::max<int32_t>(rssi + 100, 1);
+    for (int32_t other = std::max<int32_t>(channel - 4, 1); other <= std::min<int32_t>(channel + 4, JUSTWIFI_CHANNELS); ++other) {
+        int32_t load = _channel_load[other - 1] + weight * (5 - abs(other - channel)) / 5;
+        _channel_load[other - 1] = std::min<int32_t>(load, UINT16_MAX);
+    }
+
+}
+
+// SoftAP has to follow the STA channel when connected, otherwise use the least loaded one.
+// 0 when there is no scan data yet
+uint8_t JustWifi::_apChannel(uint16_t& load) {
+
+    load = 0;
+
+    uint8_t channel = 0;
+    if ((backend::status() == WL_CONNECTED) && _channelAllowed(backend::channel())) {
+        channel = backend::channel();
+    } else if (_channel_lock) {
+        channel = _nextChannel(0);
+        for (uint8_t other = _nextChannel(channel); other; other = _nextChannel(other)) {
+            if (_channel_load[other - 1] < _channel_load[channel - 1]) channel = other;
+        }
+    } else if (_channel_scanned) {
+        channel = 1;
+        for (uint8_t other = 2; other <= JUSTWIFI_AP_CHANNEL_MAX; ++other) {
+            if (_channel_load[other - 1] < _channel_load[channel - 1]) channel = other;
+        }
+    }
+
+    if ((channel >= 1) && (channel <= JUSTWIFI_CHANNELS)) {
+        load = _channel_load[channel - 1];
+    }
+
+    return channel;
+
+}
+
+bool JustWifi::_overBudget() {
+    return _loop_budget && (micros() - _loop_start >= _loop_budget);
+}
+
+int32_t JustWifi::defaultScore(const network_t& network, bool sticky) {
+
+    // Score is in 0.1 dB units, so every adjustment can be read as an RSSI offset
+    int32_t score = network.rssi * 10;
+
+    // Prefer stronger encryption a bit
+    if ((network.security == ENC_TYPE_CCMP) || (network.security == ENC_TYPE_AUTO)) {
+        score += 20;
+    } else if (network.security == ENC_TYPE_TKIP) {
+        score += 10;
+    }
+
+    // Up to 20 dB penalty when every recent attempt has failed
+    const auto& stats = network.stats;
+    if (stats.history_size) {
+        uint8_t failed = 0;
+        for (uint8_t bit = 0; bit < stats.history_size; ++bit) {
+            if (!(stats.history & (1u << bit))) ++failed;
+        }
+        score -= (200 * failed) / stats.history_size;
+    }
+
+    // 1 dB for every second of the average join time, up to 10 dB
+    if (stats.joins) {
+        score -= static_cast<int32_t>(std::min<uint32_t>(stats.join_time / stats.joins / 100, 100));
+    }
+
+    // Hysteresis, don't jump between similar networks on every reconnection
+    if (sticky) {
+        score += 50;
+    }
+
+    return score;
+
+}
+
+// Feeds the samples of the last scan to the per-network average. Missed networks lose some signal
+// and stay for a few scans, so a single bad scan neither reorders nor drops them.
+// Returns the number of candidates left
+uint8_t JustWifi::_filterRSSI() {
+
+    uint8_t candidates = 0;
+
+    for (auto& entry : _network_list) {
+
+        if (entry.scanned) {
+            int32_t sample = entry.rssi_last * 16;
+            int32_t filter = entry.rssi ? entry.rssi_filter + (sample - entry.rssi_filter) * _rssi_weight / 100 : sample;
+            entry.rssi_filter = static_cast<int16_t>(filter);
+            entry.missed = 0;
+        } else if (entry.rssi) {
+            if (++entry.missed > _rssi_misses) {
+                entry.rssi = 0;
+                entry.rssi_filter = 0;
+                entry.missed = 0;
+                continue;
+            }
+            entry.rssi_filter -= JUSTWIFI_RSSI_MISS_PENALTY * 16;
+        } else {
+            continue;
+        }
+
+        // 0 means no data
+        entry.rssi = std::min<int32_t>(entry.rssi_filter / 16, -1);
+        ++candidates;
 
-#if defined(ARDUINO_ESP8266_RELEASE_2_3_0)
-    // See https://github.com/esp8266/Arduino/issues/2186
-    if ((WiFi.getMode() & WIFI_AP) > 0) {
-        WiFi.mode(WIFI_OFF);
-        delay(10);
-        WiFi.enableAP(true);
-    } else {
-        WiFi.mode(WIFI_OFF);
     }
-#endif // defined(ARDUINO_ESP8266_RELEASE_2_3_0)
+
+    return candidates;
 
 }
 
-uint8_t JustWifi::_sortByRSSI() {
+uint8_t JustWifi::_sortByScore() {
+
+    JUSTWIFI_PROFILE(PROFILE_SORT);
 
     bool first = true;
     uint8_t bestID = 0xFF;
@@ -98,6 +319,12 @@ uint8_t JustWifi::_sortByRSSI() {
 
         // if no data skip
         if (entry->rssi == 0) continue;
+        if (!_channelAllowed(entry->channel)) continue;
+
+        entry->score = _scoring(*entry, i == _last_id);
+        if (_apCoexists() && (entry->channel == backend::softAPChannel())) {
+            entry->score += JUSTWIFI_AP_CHANNEL_BONUS;
+        }
 
         // Empty list
         if (first) {
@@ -106,7 +333,7 @@ uint8_t JustWifi::_sortByRSSI() {
             entry->next = 0xFF;
 
         // The best so far
-        } else if (entry->rssi > _network_list[bestID].rssi) {
+        } else if (entry->score > _network_list[bestID].score) {
             entry->next = bestID;
             bestID = i;
 
@@ -115,7 +342,7 @@ uint8_t JustWifi::_sortByRSSI() {
 
             network_t * current = &_network_list[bestID];
             while (current->next != 0xFF) {
-                if (entry->rssi > _network_list[current->next].rssi) {
+                if (entry->score > _network_list[current->next].score) {
                     entry->next = current->next;
                     current->next = i;
                     break;
@@ -145,14 +372,28 @@ String JustWifi::_encodingString(uint8_t security) {
     return String("OPEN");
 }
 
-uint8_t JustWifi::_populate(uint8_t networkCount) {
+// Processes scan results starting from 'index', returns true when every result was processed.
+// 'count' is incremented for every known network found. Single 'channel' scans are parts
+// of the same sweep, samples are reset by the caller when it starts
+bool JustWifi::_populate(uint8_t networkCount, uint8_t& index, uint8_t& count, uint8_t channel) {
 
-    uint8_t count = 0;
+    JUSTWIFI_PROFILE(PROFILE_POPULATE);
 
-    // Reset RSSI to disable networks that have disappeared
-    for (auto& entry : _network_list) {
-        entry.rssi = 0;
-        entry.scanned = false;
+    // Forget the previous samples, the average is updated by _filterRSSI() afterwards
+    if (0 == index) {
+        if (!channel) {
+            for (auto& entry : _network_list) {
+                entry.rssi_last = 0;
+                entry.scanned = false;
+            }
+        }
+        if (channel) {
+            if (channel <= JUSTWIFI_CHANNELS) _channel_networks[channel - 1] = 0;
+        } else {
+            std::memset(_channel_networks, 0, sizeof(_channel_networks));
+            std::memset(_channel_load, 0, sizeof(_channel_load));
+        }
+        _channel_scanned = true;
     }
 
     String ssid_scan;
@@ -160,14 +401,24 @@ uint8_t JustWifi::_populate(uint8_t networkCount) {
     uint8_t sec_scan;
     uint8_t* BSSID_scan;
     int32_t chan_scan;
-    bool hidden_scan;
 
     // TODO: ...just use linked list instead of 'next'? insert order will not remain, though
 
     // Populate defined networks with scan data
-    for (int8_t i = 0; i < networkCount; ++i) {
+    const uint8_t first = index;
+    for (; index < networkCount; ++index) {
 
-        WiFi.getNetworkInfo(i, ssid_scan, sec_scan, rssi_scan, BSSID_scan, chan_scan, hidden_scan);
+        // Continue on the next loop() call, at least one result is processed by every call
+        if ((index != first) && _overBudget()) return false;
+
+        uint8_t i = index;
+
+        if (!backend::scanResult(i, ssid_scan, sec_scan, rssi_scan, BSSID_scan, chan_scan)) continue;
+        _record(INPUT_SCAN_RESULT, i, 0, ssid_scan.c_str(), rssi_scan, sec_scan, chan_scan, BSSID_scan);
+
+        // Only the channel asked for, in case the SDK swept them all, and only the locked ones
+        if ((channel && (chan_scan != channel)) || !_channelAllowed(chan_scan)) continue;
+        _countChannel(chan_scan, rssi_scan);
 
         bool known = false;
 
@@ -183,8 +434,8 @@ uint8_t JustWifi::_populate(uint8_t networkCount) {
                 // In case of several networks with the same SSID
                 // we want to get the one with the best RSSI
                 // Thanks to Robert (robi772 @ bitbucket.org)
-                if (entry->rssi < rssi_scan || entry->rssi == 0) {
-                    entry->rssi = rssi_scan;
+                if (entry->rssi_last < rssi_scan || entry->rssi_last == 0) {
+                    entry->rssi_last = rssi_scan;
                     entry->security = sec_scan;
                     entry->channel = chan_scan;
                     entry->scanned = true;
@@ -215,35 +466,51 @@ uint8_t JustWifi::_populate(uint8_t networkCount) {
 
     }
 
-    return count;
+    return true;
 
 }
 
 uint8_t JustWifi::_doSTA(uint8_t id) {
 
-    static uint8_t networkID;
     static uint8_t state = RESPONSE_START;
     static unsigned long timeout;
+    static wl_status_t status;
+    static unsigned long join_start;
+    static bool prepared;
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    static bool kept;
+#endif
 
     // Reset connection process
     if (id != 0xFF) {
         state = RESPONSE_START;
-        networkID = id;
+        prepared = false;
+    }
+
+    // Network being tried is always the current candidate, list changes keep the index up to date
+    uint8_t networkID = (id != 0xFF) ? id : _currentID;
+    if (networkID >= _network_list.size()) {
+        return (state = RESPONSE_FAIL);
     }
 
-    // Get network
     auto& entry = _network_list[networkID];
 
     // No state or previous network failed
-    if (RESPONSE_START == state) {
+    // Radio setup and the connection itself are done in separate loop() calls when over budget
+    if ((RESPONSE_START == state) && !prepared) {
 
-        _disable();
-        WiFi.enableSTA(true);
-        WiFi.hostname(_hostname);
+        _finishSession();
+        _stats_id = networkID;
+        ++entry.stats.attempts;
+        join_start = millis();
+        _preparePower(networkID);
+
+        backend::enableSTA(true);
+        backend::hostname(_hostname);
 
         // Configure static options
         if (!entry.dhcp) {
-            WiFi.config(entry.ip, entry.gw, entry.netmask, entry.dns);
+            backend::config(entry.ip, entry.gw, entry.netmask, entry.dns);
         }
 
         // Connect
@@ -261,91 +528,62 @@ uint8_t JustWifi::_doSTA(uint8_t id) {
             } else {
                 snprintf_P(buffer, sizeof(buffer), PSTR("SSID: %s"), entry.ssid);
             }
+            _trace(MESSAGE_CONNECTING, networkID, entry.rssi, backend::status());
 		    _doCallback(MESSAGE_CONNECTING, buffer);
         }
 
-#ifdef JUSTWIFI_ENABLE_ENTERPRISE
-        // **Note**: this will only work with PEAP/TTPS configurations, see:
-        // https://github.com/xoseperez/justwifi/pull/18
-
-        // We need to manually do the connection, without WiFi.begin()
-        if (entry.enterprise_username && entry.enterprise_password) {
-            station_config wifi_config{};
+        prepared = true;
+        if (_overBudget()) {
+            return state;
+        }
 
-            // c/p from ESP8266WiFiSTA
-            // since we never pass along the real SSID size, we depend on '\0' < 32 and no '\0' when exactly 32
-            if (SsidSizeMax == strlen(entry.ssid)) {
-                std::memcpy(reinterpret_cast<char*>(wifi_config.ssid), entry.ssid, SsidSizeMax);
-            } else {
-                std::strcpy(reinterpret_cast<char*>(wifi_config.ssid), entry.ssid);
-            }
+    }
 
-            wifi_config.bssid_set = 0;
-            if (entry.channel) {
-                wifi_config.bssid_set = 1;
-                std::memcpy(reinterpret_cast<uint8_t*>(wifi_config.bssid), entry.bssid, sizeof(entry.bssid));
-            }
+    if (RESPONSE_START == state) {
 
-            *wifi_config.password = 0;
-
-            // TODO: from ESP8266WiFiSTA, we see following calls around most of these funcs
-            // > ETS_UART_INTR_DISABLE();
-            // > ... call something() ...
-            // > ETS_UART_INTR_ENABLE();
-            // Do we need those? e.g., nodemcu-firmware code does not bother with this lock:
-            // e.g. https://github.com/nodemcu/nodemcu-firmware/blob/...branch.../app/modules/wifi.c
-            wifi_set_opmode(STATION_MODE);
-            wifi_station_set_config_current(&wifi_config);
-            wifi_station_set_enterprise_disable_time_check(1);
-            wifi_station_clear_cert_key();
-            wifi_station_clear_enterprise_ca_cert();
-            wifi_station_set_wpa2_enterprise_auth(1);
-
-            // Note: this is safe on ESP b/c we use -funsigned-char
-            wifi_station_set_enterprise_identity((uint8_t*)entry.enterprise_username, strlen(entry.enterprise_username));
-            wifi_station_set_enterprise_username((uint8_t*)entry.enterprise_username, strlen(entry.enterprise_username));
-            wifi_station_set_enterprise_password((uint8_t*)entry.enterprise_password, strlen(entry.enterprise_password));
-
-            wifi_station_connect();
-            if (entry.channel) {
-                wifi_set_channel(entry.channel);
-            }
+        prepared = false;
 
-            // We don't (?) need identity structs in RAM anymore
-            wifi_station_clear_enterprise_identity();
-            wifi_station_clear_enterprise_username();
-            wifi_station_clear_enterprise_password();
-            wifi_station_clear_cert_key();
-            wifi_station_clear_enterprise_ca_cert();
+#if JUSTWIFI_ENABLE_ENTERPRISE
+        kept = false;
+        if (entry.enterprise_username && entry.enterprise_password) {
+            backend::connectEnterprise(entry.ssid, entry.enterprise_username, entry.enterprise_password, entry.channel, entry.bssid, kept);
         } else
 #endif
-
-        if (entry.channel) {
-            WiFi.begin(entry.ssid, entry.pass, entry.channel, entry.bssid);
-        } else {
-            WiFi.begin(entry.ssid, entry.pass);
-        }
+        backend::connect(entry.ssid, entry.pass, entry.channel, entry.bssid);
 
         timeout = millis();
+        status = backend::status();
+        _record(INPUT_CONNECT, status, 0, entry.ssid, entry.rssi, entry.security, entry.channel, entry.bssid);
         return (state = RESPONSE_WAIT);
 
     }
 
-    // Connected?
-    if (WiFi.status() == WL_CONNECTED) {
-
-        // Autoconnect only if DHCP, since it doesn't store static IP data
-        WiFi.setAutoConnect(entry.dhcp);
+    // Only record status transitions, not every poll
+    wl_status_t current = backend::status();
+    if (current != status) {
+        status = current;
+        _record(INPUT_STATUS, status, millis() - timeout);
+        _trace(MESSAGE_CONNECT_WAITING, networkID, entry.rssi, status);
+    }
 
-        WiFi.setAutoReconnect(true);
-        _doCallback(MESSAGE_CONNECTED);
+    // Connected?
+    if (current == WL_CONNECTED) {
+        unsigned long join_time = millis() - join_start;
+#if JUSTWIFI_ENABLE_ENTERPRISE
+        if (kept) {
+            ++entry.stats.kept;
+            entry.stats.kept_time += join_time;
+        }
+#endif
+        _onConnected(networkID, join_time);
         return (state = RESPONSE_OK);
-
     }
 
     // Check timeout
     if (millis() - timeout > _connect_timeout) {
-        WiFi.enableSTA(false);
+        backend::enableSTA(false);
+        _recordAttempt(entry, false);
+        _trace(MESSAGE_CONNECT_FAILED, networkID, entry.rssi, current);
         _doCallback(MESSAGE_CONNECT_FAILED, entry.ssid);
         return (state = RESPONSE_FAIL);
     }
@@ -356,32 +594,108 @@ uint8_t JustWifi::_doSTA(uint8_t id) {
 
 }
 
+// 'timed' is false when the link was already up and we did not see the association
+void JustWifi::_onConnected(uint8_t id, unsigned long join_time, bool timed) {
+
+    auto& entry = _network_list[id];
+
+    // Autoconnect only if DHCP, since it doesn't store static IP data
+    backend::autoConnect(entry.dhcp);
+
+    backend::autoReconnect(true);
+    if (timed) {
+        ++entry.stats.joins;
+        entry.stats.join_time += join_time;
+    }
+    _recordAttempt(entry, true);
+    _startSession();
+
+    if (_provisioning) {
+        _provisioning = false;
+        _provision_time = millis() - _provision_start;
+    }
+
+    _trace(MESSAGE_CONNECTED, id, backend::rssi(), WL_CONNECTED);
+    _doCallback(MESSAGE_CONNECTED);
+
+    _applyPower(id);
+
+}
+
+// Use WPS / SmartConfig results right away, without scanning for the network again.
+// SDK might have already connected, keep that link when it did
+void JustWifi::_provisioned() {
+
+    backend::StationConfig config;
+    network_t * network = nullptr;
+    if (backend::stationConfig(config)) {
+        _record(INPUT_PROVISION, 1, millis() - _provision_start, config.ssid, 0, 0,
+            config.channel, config.channel ? config.bssid : nullptr);
+        network = _makeNetwork(config.ssid, config.pass);
+    }
+
+    if (!network) {
+        _provisioning = false;
+        _state = STATE_IDLE;
+        return;
+    }
+
+    if (config.channel) {
+        network->channel = config.channel;
+        std::memcpy(network->bssid, config.bssid, sizeof(network->bssid));
+    }
+
+    if (!_addNetwork(network)) {
+        _provisioning = false;
+        _state = STATE_IDLE;
+        return;
+    }
+    _currentID = _network_list.size() - 1;
+
+    if (backend::status() == WL_CONNECTED) {
+        _finishSession();
+        _stats_id = _currentID;
+        ++_network_list[_currentID].stats.attempts;
+        _onConnected(_currentID, 0, false);
+        _state = STATE_STA_SUCCESS;
+        return;
+    }
+
+    _state = STATE_STA_START;
+
+}
+
 bool JustWifi::_doAP() {
 
-    // If already created recreate
-    if (_ap_connected) enableAP(false);
+    // If already created recreate, unless it should be kept alive for the clients
+    if (_ap_connected) {
+        if (_ap_coexistence) return true;
+        _enableAP(false);
+    }
 
     // If we never set anything via setSoftAP, use default hostname as SSID
     if (!_softap.ssid) {
         _softap.ssid = _hostname;
     }
 
-    WiFi.enableAP(true);
+    backend::enableAP(true);
 
     // Configure static options
     if (_softap.dhcp) {
-        WiFi.softAPConfig(_softap.ip, _softap.gw, _softap.netmask);
+        backend::softAPConfig(_softap.ip, _softap.gw, _softap.netmask);
     }
 
     _doCallback(MESSAGE_ACCESSPOINT_CREATING);
 
-    if (_softap.pass) {
-        WiFi.softAP(_softap.ssid, _softap.pass);
-    } else {
-        WiFi.softAP(_softap.ssid);
-    }
+    uint16_t load;
+    uint8_t channel = _apChannel(load);
+    backend::softAP(_softap.ssid, _softap.pass, channel);
 
-    _doCallback(MESSAGE_ACCESSPOINT_CREATED);
+    char buffer[48];
+    uint8_t current = backend::softAPChannel();
+    snprintf_P(buffer, sizeof(buffer), PSTR("CH: %u, NETWORKS: %u, LOAD: %u"), current,
+        ((current >= 1) && (current <= JUSTWIFI_CHANNELS)) ? _channel_networks[current - 1] : 0, load);
+    _doCallback(MESSAGE_ACCESSPOINT_CREATED, buffer);
 
     _ap_connected = true;
     return true;
@@ -391,154 +705,748 @@ bool JustWifi::_doAP() {
 uint8_t JustWifi::_doScan() {
 
     static bool scanning = false;
+    static bool populating = false;
+    static uint8_t index = 0;
+    static uint8_t count = 0;
+    static unsigned long start = 0;
+
+    // Channel by channel, see setScanSlices() and setChannelLock(). Otherwise a single sweep,
+    // with the results outside of the lock dropped
+    if ((_slice_channels || _channel_lock) && backend::scanSingleChannel()) {
+        if (false == scanning) {
+            if (!_apCoexists()) backend::disconnect();
+            backend::enableSTA(true);
+        }
+        uint8_t response = _doScanSlice(!scanning);
+        scanning = (RESPONSE_WAIT == response);
+        if (RESPONSE_OK == response) {
+            _currentID = _sortByScore();
+            if (0xFF == _currentID) {
+                _trace(MESSAGE_NO_KNOWN_NETWORKS, JUSTWIFI_TRACE_NO_NETWORK, 0, 0);
+                _doCallback(MESSAGE_NO_KNOWN_NETWORKS);
+                return RESPONSE_FAIL;
+            }
+            _trace(MESSAGE_FOUND_NETWORK, _currentID, _network_list[_currentID].rssi, 0);
+        }
+        return response;
+    }
 
     // If not scanning, start scan
     if (false == scanning) {
-        WiFi.disconnect();
-        WiFi.enableSTA(true);
-        WiFi.scanNetworks(true, true);
+        if (!_apCoexists()) backend::disconnect();
+        backend::enableSTA(true);
+        backend::scanStart(0, 0);
+        start = millis();
+        _trace(MESSAGE_SCANNING);
         _doCallback(MESSAGE_SCANNING);
         scanning = true;
         return RESPONSE_WAIT;
     }
 
     // Check if scanning
-    int8_t scanResult = WiFi.scanComplete();
+    int8_t scanResult = backend::scanComplete();
     if (WIFI_SCAN_RUNNING == scanResult) {
         return RESPONSE_WAIT;
     }
 
-    // Scan finished
-    scanning = false;
+    // Scan finished, results can take more than one call to process
+    if (!populating) {
+        index = 0;
+        count = 0;
+        _record(INPUT_SCAN, scanResult, millis() - start);
+#if JUSTWIFI_ENABLE_PROFILE
+        _scan_results = (scanResult > 0) ? scanResult : 0;
+#endif
+    }
 
     // Sometimes the scan fails,
     // this will force the scan to restart
     if (WIFI_SCAN_FAILED == scanResult) {
+        scanning = false;
+        _trace(MESSAGE_SCAN_FAILED);
         _doCallback(MESSAGE_SCAN_FAILED);
         return RESPONSE_WAIT;
     }
 
     // Check networks
     if (0 == scanResult) {
+        scanning = false;
+        _trace(MESSAGE_NO_NETWORKS);
         _doCallback(MESSAGE_NO_NETWORKS);
         return RESPONSE_FAIL;
     }
 
-    // Populate network list
-    uint8_t count = _populate(scanResult);
+    // Populate network list, results are kept until scanDelete()
+    populating = !_populate(scanResult, index, count);
+    scanning = populating;
+    if (populating) {
+        return RESPONSE_WAIT;
+    }
 
     // Free memory
-    WiFi.scanDelete();
+    backend::scanDelete();
 
-    if (0 == count) {
+    // Networks missed by this scan can still be candidates, see setRSSIFilter()
+    if (0 == _filterRSSI()) {
+        _trace(MESSAGE_NO_KNOWN_NETWORKS, JUSTWIFI_TRACE_NO_NETWORK, 0, scanResult);
         _doCallback(MESSAGE_NO_KNOWN_NETWORKS);
         return RESPONSE_FAIL;
     }
 
-    // Sort networks by RSSI
-    _currentID = _sortByRSSI();
+    // Sort networks by score
+    _currentID = _sortByScore();
+    _trace(MESSAGE_FOUND_NETWORK, _currentID, _network_list[_currentID].rssi, scanResult);
     return RESPONSE_OK;
 
 }
 
-void JustWifi::_doCallback(justwifi_messages_t message, char * parameter) {
-    for (unsigned char i=0; i < _callbacks.size(); i++) {
-        (_callbacks[i])(message, parameter);
+// Scans one channel at a time, '_slice_channels' of them back to back and then waits '_slice_gap' ms,
+// so the radio is never off-channel for long. Returns RESPONSE_OK after the last channel,
+// or RESPONSE_FAIL when none of the known networks were found by the whole sweep
+uint8_t JustWifi::_doScanSlice(bool reset) {
+
+    static uint8_t channel = 0;
+    static uint8_t scanned = 0;
+    static bool sweeping = false;
+    static bool scanning = false;
+    static bool populating = false;
+    static bool waiting = false;
+    static uint8_t index = 0;
+    static uint8_t count = 0;
+    static uint32_t off_channel = 0;
+    static unsigned long start = 0;
+
+    if (reset) {
+        channel = 0;
+        scanned = 0;
+        sweeping = false;
+        scanning = false;
+        populating = false;
+        waiting = false;
+        off_channel = 0;
     }
-}
 
-String JustWifi::_MAC2String(const unsigned char* mac) {
-    char buffer[20];
-    snprintf(
-        buffer, sizeof(buffer),
-        "%02x:%02x:%02x:%02x:%02x:%02x",
-        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]
-    );
-    return String(buffer);
-}
+    // Let the STA and SoftAP catch up between slices
+    if (waiting) {
+        if (millis() - start < _slice_gap) return RESPONSE_WAIT;
+        waiting = false;
+    }
 
-void JustWifi::_machine() {
+    if (false == scanning) {
+        if (!sweeping) {
+            sweeping = true;
+            channel = _nextChannel(0);
+            count = 0;
+            for (auto& entry : _network_list) {
+                entry.rssi_last = 0;
+                entry.scanned = false;
+            }
+            std::memset(_channel_load, 0, sizeof(_channel_load));
+            _trace(MESSAGE_SCANNING);
+            _doCallback(MESSAGE_SCANNING);
+        }
+        backend::scanStart(channel, _slice_dwell);
+        start = millis();
+        scanning = true;
+        return RESPONSE_WAIT;
+    }
 
-    #if false
-        static unsigned char previous = 0xFF;
-        if (_state != previous) {
-            previous = _state;
-            Serial.printf("_state: %u, WiFi.getMode(): %u\n", _state, WiFi.getMode());
+    int8_t scanResult = backend::scanComplete();
+    if (WIFI_SCAN_RUNNING == scanResult) {
+        return RESPONSE_WAIT;
+    }
+
+    if (!populating) {
+        index = 0;
+        off_channel += millis() - start;
+        _record(INPUT_SCAN, scanResult, millis() - start);
+#if JUSTWIFI_ENABLE_PROFILE
+        _scan_results = (scanResult > 0) ? scanResult : 0;
+#endif
+    }
+
+    // Failed channel is skipped instead of retried, it could be one the SDK does not allow
+    if (WIFI_SCAN_FAILED == scanResult) {
+        _trace(MESSAGE_SCAN_FAILED);
+        _doCallback(MESSAGE_SCAN_FAILED);
+    } else if (scanResult > 0) {
+        populating = !_populate(scanResult, index, count, channel);
+        if (populating) {
+            return RESPONSE_WAIT;
         }
-    #endif
+    }
 
-    switch(_state) {
+    backend::scanDelete();
+    scanning = false;
 
-        // ---------------------------------------------------------------------
+    // Without slices, only the locked channels are scanned back to back
+    channel = _nextChannel(channel);
+    bool sweep = (0 == channel);
+    if ((++scanned < (_slice_channels ? _slice_channels : JUSTWIFI_CHANNELS)) && !sweep) {
+        return RESPONSE_WAIT;
+    }
 
-        case STATE_IDLE:
+    ++_scan_stats.slices;
+    _scan_stats.last = off_channel;
+    _scan_stats.total += off_channel;
+    if (off_channel > _scan_stats.max) _scan_stats.max = off_channel;
 
-            // Should we connect in STA mode?
-            if (WiFi.status() != WL_CONNECTED) {
+    scanned = 0;
+    off_channel = 0;
+    waiting = true;
+    start = millis();
 
-                if (_sta_enabled) {
-                    if (_network_list.size() > 0) {
-                        if ((0 == _timeout) || ((_reconnect_timeout > 0) && (millis() - _timeout > _reconnect_timeout))) {
-                            _currentID = 0;
-                            _state = _scan ? STATE_SCAN_START : STATE_STA_START;
-                            return;
-                        }
-                    }
-                }
+    if (!sweep) {
+        return RESPONSE_WAIT;
+    }
 
-                // Fallback
-                if (!_ap_connected && _ap_fallback_enabled) {
-                    _state = STATE_FALLBACK;
-                }
+    sweeping = false;
+    ++_scan_stats.sweeps;
 
-            }
+    if (0 == _filterRSSI()) {
+        _trace(MESSAGE_NO_KNOWN_NETWORKS, JUSTWIFI_TRACE_NO_NETWORK, 0, 0);
+        _doCallback(MESSAGE_NO_KNOWN_NETWORKS);
+        return RESPONSE_FAIL;
+    }
 
+    return RESPONSE_OK;
 
-            break;
+}
 
-        // ---------------------------------------------------------------------
+// Keeps the candidates order fresh while connected, without touching the current network
+void JustWifi::_doBackgroundScan() {
 
-        case STATE_SCAN_START:
-            _doScan();
-            _state = STATE_SCAN_ONGOING;
-            break;
+    if (!_useScan() || !_slice_channels || !_slice_background) return;
+    if (!backend::scanSingleChannel()) return;
 
-        case STATE_SCAN_ONGOING:
-            {
-                uint8_t response = _doScan();
-                if (RESPONSE_OK == response) {
-                    _state = STATE_STA_START;
-                } else if (RESPONSE_FAIL == response) {
-                    _state = STATE_FALLBACK;
-                }
-            }
-            break;
+    if (RESPONSE_OK == _doScanSlice()) {
+        _sortByScore();
+    }
 
-        // ---------------------------------------------------------------------
+}
 
-        case STATE_STA_START:
-            _doSTA(_currentID);
-            _state = STATE_STA_ONGOING;
-            break;
+// Runs right after connecting, until every warm-up host was looked up. Returns RESPONSE_OK
+// when the network is ready, RESPONSE_FAIL when the link dropped in the meantime
+uint8_t JustWifi::_doWarmup(bool reset) {
+
+    static size_t host = 0;
+    static uint8_t resolved = 0;
+    static bool resolving = false;
+    static unsigned long start = 0;
+    static unsigned long lookup = 0;
+
+    if (reset) {
+        host = 0;
+        resolved = 0;
+        resolving = false;
+        start = millis();
+        backend::arpAnnounce(backend::gatewayIP());
+        if (_warmup_ntp) {
+            backend::sntpStart(_warmup_ntp);
+        }
+        return RESPONSE_WAIT;
+    }
 
-        case STATE_STA_ONGOING:
+    if (backend::status() != WL_CONNECTED) {
+        return RESPONSE_FAIL;
+    }
+
+    const size_t first = host;
+    for (; host < _warmup_count; ++host) {
+
+        if ((host != first) && _overBudget()) return RESPONSE_WAIT;
+
+        if (!resolving) {
+            lookup = millis();
+            if (!backend::resolveStart(_warmup_hosts[host])) continue;
+            resolving = true;
+        }
+
+        auto status = backend::resolveStatus();
+        if ((backend::Resolve::Running == status) && (millis() - lookup < JUSTWIFI_WARMUP_TIMEOUT)) {
+            return RESPONSE_WAIT;
+        }
+
+        resolving = false;
+        bool success = (backend::Resolve::Success == status);
+        if (success) ++resolved;
+        _record(INPUT_RESOLVE, success, millis() - lookup, _warmup_hosts[host]);
+
+    }
+
+    _ready_time = millis() - start;
+
+    char buffer[48];
+    snprintf_P(buffer, sizeof(buffer), PSTR("TIME: %lu, RESOLVED: %u/%u"),
+        _ready_time, resolved, static_cast<unsigned>(_warmup_count));
+    _trace(MESSAGE_NETWORK_READY, _stats_id, backend::rssi(), resolved);
+    _doCallback(MESSAGE_NETWORK_READY, buffer);
+
+    return RESPONSE_OK;
+
+}
+
+void JustWifi::_doCallback(justwifi_messages_t message, char * parameter) {
+    JUSTWIFI_PROFILE(PROFILE_CALLBACK);
+    for (unsigned char i=0; i < _callbacks.size(); i++) {
+        (_callbacks[i])(message, parameter);
+    }
+}
+
+void JustWifi::_recordAttempt(network_t& entry, bool success) {
+    auto& stats = entry.stats;
+    stats.history = (stats.history << 1) | (success ? 1u : 0u);
+    if (stats.history_size < 8) ++stats.history_size;
+}
+
+void JustWifi::_startSession() {
+    if (_stats_id >= _network_list.size()) return;
+    ++_network_list[_stats_id].stats.successes;
+    _last_id = _stats_id;
+    _sta_session = true;
+    _sta_session_start = millis();
+    _health_lost = 0;
+    _health_pending = false;
+    _health_start = _sta_session_start;
+}
+
+void JustWifi::_finishSession() {
+    if (!_sta_session) return;
+    _sta_session = false;
+    if (_stats_id >= _network_list.size()) return;
+
+    auto& stats = _network_list[_stats_id].stats;
+    uint32_t session = millis() - _sta_session_start;
+    stats.uptime += session;
+    if (session > stats.longest) stats.longest = session;
+}
+
+void JustWifi::_doStats() {
+
+    uint8_t reason = _disconnected_reason;
+    if (reason) {
+        _disconnected_reason = 0;
+
+        // Reasons are also reported for every failed attempt,
+        // only a dropped session is a disconnection from the user point of view
+        bool dropped = _sta_session;
+        _finishSession();
+
+        if (_stats_id < _network_list.size()) {
+            auto& entry = _network_list[_stats_id];
+            ++entry.stats.reasons[reasonIndex(reason)];
+            entry.stats.last_reason = reason;
+
+            if (dropped) {
+                ++entry.stats.disconnects;
+                char buffer[64];
+                snprintf_P(buffer, sizeof(buffer), PSTR("REASON: %u, SSID: %s"), reason, entry.ssid);
+                _trace(MESSAGE_DISCONNECTED, _stats_id, 0, reason);
+                _doCallback(MESSAGE_DISCONNECTED, buffer);
+            }
+        }
+    }
+
+    // SDK reconnected by itself (setAutoReconnect) while we were idle, an attempt of its own
+    if (!_sta_session && (STATE_IDLE == _state) && (backend::status() == WL_CONNECTED)) {
+        if (_stats_id < _network_list.size()) {
+            auto& entry = _network_list[_stats_id];
+            ++entry.stats.attempts;
+            _recordAttempt(entry, true);
+        }
+        _startSession();
+    }
+
+}
+
+void JustWifi::_doHeap() {
+
+    uint32_t* sample = nullptr;
+    bool lowest = true;
+
+    switch (_state) {
+    case STATE_SCAN_START:
+    case STATE_SCAN_ONGOING:
+        sample = &_heap.scan;
+        break;
+    case STATE_STA_START:
+    case STATE_STA_ONGOING:
+        sample = &_heap.connect;
+        break;
+    case STATE_IDLE:
+        if (!_sta_session) return;
+        sample = &_heap.idle;
+        lowest = false;
+        break;
+    default:
+        return;
+    }
+
+    uint32_t free = backend::freeHeap();
+    if (!lowest || !*sample || (free < *sample)) {
+        *sample = free;
+    }
+
+}
+
+const justwifi_power_t& JustWifi::_powerPolicy(uint8_t id) {
+    if ((id < _network_list.size()) && _network_list[id].power_set) {
+        return _network_list[id].power;
+    }
+    return _power_policy;
+}
+
+// Join at full power, PHY mode changes while associated would drop the link
+void JustWifi::_preparePower(uint8_t id) {
+
+    const auto& policy = _powerPolicy(id);
+    switch (policy.phy) {
+    case PHY_11B:
+        backend::phyMode(backend::Phy::B);
+        break;
+    case PHY_11G:
+        backend::phyMode(backend::Phy::G);
+        break;
+    case PHY_11N:
+        backend::phyMode(backend::Phy::N);
+        break;
+    }
+
+    if (_power_stats.tx_power && (_power_stats.tx_power != JUSTWIFI_TX_POWER_MAX)) {
+        backend::txPower(JUSTWIFI_TX_POWER_MAX);
+        _power_stats.tx_power = JUSTWIFI_TX_POWER_MAX;
+    }
+
+}
+
+void JustWifi::_applyPower(uint8_t id) {
+
+    const auto& policy = _powerPolicy(id);
+    switch (policy.sleep) {
+    case SLEEP_NONE:
+        backend::sleepMode(backend::Sleep::None, 0);
+        break;
+    case SLEEP_LIGHT:
+        backend::sleepMode(backend::Sleep::Light, policy.listen_interval);
+        break;
+    case SLEEP_MODEM:
+        backend::sleepMode(backend::Sleep::Modem, policy.listen_interval);
+        break;
+    }
+
+    // Both SDKs default to modem sleep, waking up for every DTIM
+    if (SLEEP_NONE == policy.sleep) {
+        _power_duty = 1000;
+    } else {
+        uint32_t period = JUSTWIFI_BEACON_INTERVAL * std::max<uint8_t>(policy.listen_interval, 1);
+        _power_duty = std::min<uint32_t>(1000, JUSTWIFI_POWER_WAKE_MS * 1000 / period);
+    }
+
+    _applyTxPower(policy);
+    _power_check = millis();
+
+}
+
+void JustWifi::_applyTxPower(const justwifi_power_t& policy) {
+
+    if (!policy.rssi_target) return;
+
+    // Positive values are reported when there is no signal
+    int32_t rssi = backend::rssi();
+    if (rssi >= 0) return;
+
+    int32_t margin = rssi - policy.rssi_target;
+    uint8_t dbm = std::max<int32_t>(JUSTWIFI_TX_POWER_MIN, std::min<int32_t>(JUSTWIFI_TX_POWER_MAX, JUSTWIFI_TX_POWER_MAX - margin));
+    if (dbm == _power_stats.tx_power) return;
+
+    backend::txPower(dbm);
+    _power_stats.tx_power = dbm;
+
+}
+
+// Radio is on while scanning, connecting or serving the SoftAP,
+// connected station is on for the duty cycle of its sleep mode
+void JustWifi::_doPower() {
+
+    unsigned long now = millis();
+    uint32_t elapsed = now - _power_tick;
+    _power_tick = now;
+
+    uint32_t duty = 1000;
+    if (WIFI_OFF == backend::mode()) {
+        duty = 0;
+    } else if (_sta_session && !_ap_connected && (STATE_IDLE == _state)) {
+        duty = _power_duty;
+    }
+
+    _power_stats.total += elapsed;
+    _power_remainder += elapsed * duty;
+    _power_stats.radio_on += _power_remainder / 1000;
+    _power_remainder %= 1000;
+
+    if (_sta_session && (now - _power_check > JUSTWIFI_POWER_INTERVAL)) {
+        _power_check = now;
+        _applyTxPower(_powerPolicy(_stats_id));
+    }
+
+}
+
+void JustWifi::_doHealth() {
+
+    if (!_health_interval || !_sta_session) return;
+    if (_stats_id >= _network_list.size()) return;
+
+    auto& stats = _network_list[_stats_id].stats;
+
+    if (_health_pending) {
+
+        uint32_t rtt;
+        if (backend::probeReply(rtt)) {
+            _record(INPUT_PROBE, 1, rtt);
+            _health_pending = false;
+            _health_lost = 0;
+            stats.rtt = std::min<uint32_t>(rtt, UINT16_MAX);
+            if (stats.rtt > stats.rtt_max) stats.rtt_max = stats.rtt;
+        } else if (millis() - _health_start > JUSTWIFI_HEALTH_TIMEOUT) {
+            _record(INPUT_PROBE, 0, millis() - _health_start);
+            _health_pending = false;
+            ++stats.lost;
+            if (++_health_lost >= _health_misses) {
+                _unreachable();
+            }
+        }
+
+        return;
+
+    }
+
+    if (millis() - _health_start < _health_interval) return;
+    _health_start = millis();
+
+    // Nothing to probe with static configuration without a gateway
+    IPAddress gateway = backend::gatewayIP();
+    if (!static_cast<uint32_t>(gateway)) return;
+
+    if (backend::probeStart(gateway)) {
+        ++stats.probes;
+        _health_pending = true;
+    }
+
+}
+
+// Associated, but the gateway does not answer. Drop the link and try the next candidate
+// right away instead of waiting for the reconnect interval
+void JustWifi::_unreachable() {
+
+    auto& entry = _network_list[_stats_id];
+    ++entry.stats.unreachable;
+    _recordAttempt(entry, false);
+
+    char buffer[64];
+    snprintf_P(buffer, sizeof(buffer), PSTR("SSID: %s, LOST: %u"), entry.ssid, _health_lost);
+    _trace(MESSAGE_GATEWAY_UNREACHABLE, _stats_id, backend::rssi(), _health_lost);
+    _doCallback(MESSAGE_GATEWAY_UNREACHABLE, buffer);
+
+    _finishSession();
+    _currentID = _stats_id;
+    _stats_id = 0xFF;
+    backend::disconnect();
+
+    // Same format as the SDK disconnections
+    snprintf_P(buffer, sizeof(buffer), PSTR("REASON: %u, SSID: %s"), JUSTWIFI_REASON_UNREACHABLE, entry.ssid);
+    _doCallback(MESSAGE_DISCONNECTED, buffer);
+
+    _state = _nextCandidate();
+    if (STATE_STA_FAILED == _state) {
+        _currentID = 0;
+        _state = _useScan() ? STATE_SCAN_START : STATE_STA_START;
+    }
+
+}
+
+void JustWifi::_record(
+    justwifi_input_types_t type, uint8_t value, uint32_t time,
+    const char * ssid, int32_t rssi, uint8_t security, uint8_t channel, const uint8_t * bssid
+) {
+
+    if (!_recorder) return;
+
+    justwifi_input_t input {};
+    input.time = time;
+    input.type = type;
+    input.value = value;
+    input.rssi = static_cast<int8_t>(std::max(rssi, static_cast<int32_t>(INT8_MIN)));
+    input.security = security;
+    input.channel = channel;
+    if (bssid) std::memcpy(input.bssid, bssid, sizeof(input.bssid));
+    if (ssid) strncpy(input.ssid, ssid, sizeof(input.ssid) - 1);
+
+    _recorder(input);
+
+}
+
+void JustWifi::_trace(uint8_t message, uint8_t network, int32_t rssi, uint8_t status) {
+
+#if JUSTWIFI_TRACE_SIZE
+    uint32_t start = backend::cycles();
+
+    auto& record = _trace_buffer[_trace_head];
+    record.timestamp = millis();
+    record.state = _trace_state;
+    record.next_state = _state;
+    record.message = message;
+    record.network = network;
+    record.rssi = static_cast<int8_t>(std::max(rssi, static_cast<int32_t>(INT8_MIN)));
+    record.status = status;
+
+    _trace_state = _state;
+    _trace_head = (_trace_head + 1) % JUSTWIFI_TRACE_SIZE;
+    if (_trace_count < JUSTWIFI_TRACE_SIZE) ++_trace_count;
+
+    uint32_t cycles = backend::cycles() - start;
+    if (cycles > _trace_cycles) _trace_cycles = cycles;
+#else
+    (void) message;
+    (void) network;
+    (void) rssi;
+    (void) status;
+#endif
+
+}
+
+String JustWifi::_MAC2String(const unsigned char* mac) {
+    char buffer[20];
+    snprintf(
+        buffer, sizeof(buffer),
+        "%02x:%02x:%02x:%02x:%02x:%02x",
+        mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]
+    );
+    return String(buffer);
+}
+
+justwifi_states_t JustWifi::_nextCandidate() {
+    if (_currentID >= _network_list.size()) {
+        return STATE_STA_FAILED;
+    }
+    if (_useScan()) {
+        _currentID = _network_list[_currentID].next;
+        if (_currentID == 0xFF) {
+            return STATE_STA_FAILED;
+        }
+    } else {
+        _currentID++;
+        if (_currentID >= _network_list.size()) {
+            return STATE_STA_FAILED;
+        }
+    }
+    return STATE_STA_START;
+}
+
+void JustWifi::_machine() {
+
+#if JUSTWIFI_ENABLE_PROFILE
+    // Only idle ticks are interesting, other states are dominated by the SDK calls
+    if (STATE_IDLE == _state) {
+        JUSTWIFI_PROFILE(PROFILE_IDLE);
+        _machineStep();
+        return;
+    }
+#endif
+
+    _machineStep();
+
+}
+
+void JustWifi::_machineStep() {
+
+#if JUSTWIFI_TRACE_SIZE
+    if (_state != _trace_state) {
+        _trace(JUSTWIFI_TRACE_NO_MESSAGE, _currentID, 0, backend::mode());
+    }
+#endif
+
+    switch(_state) {
+
+        // ---------------------------------------------------------------------
+
+        case STATE_IDLE:
+
+            // Should we connect in STA mode?
+            if (backend::status() != WL_CONNECTED) {
+
+                if (_sta_enabled) {
+                    if (_network_list.size() > 0) {
+                        if ((0 == _timeout) || ((_reconnect_timeout > 0) && (millis() - _timeout > _reconnect_timeout))) {
+                            _currentID = 0;
+                            _state = _useScan() ? STATE_SCAN_START : STATE_STA_START;
+                            return;
+                        }
+                    }
+                }
+
+                // Fallback
+                if (!_ap_connected && _ap_fallback_enabled) {
+                    _state = STATE_FALLBACK;
+                }
+
+            } else {
+                _doHealth();
+                _doBackgroundScan();
+            }
+
+
+            break;
+
+        // ---------------------------------------------------------------------
+
+        case STATE_SCAN_START:
+            _doScan();
+            _state = STATE_SCAN_ONGOING;
+            break;
+
+        case STATE_SCAN_ONGOING:
+            {
+                uint8_t response = _doScan();
+                if (RESPONSE_OK == response) {
+                    _state = STATE_STA_START;
+                } else if (RESPONSE_FAIL == response) {
+                    _state = STATE_FALLBACK;
+                }
+            }
+            break;
+
+        // ---------------------------------------------------------------------
+
+        case STATE_STA_START:
+            if (_currentID >= _network_list.size()) {
+                _state = STATE_STA_FAILED;
+                break;
+            }
+            if (!_lockAllows(_currentID) || !_apChannelAllowed(_currentID)) {
+                _state = _nextCandidate();
+                break;
+            }
+
+            // Moving between the locked channels is announced, ESP-NOW peers have to follow
+            if (_channel_lock) {
+                uint8_t current = backend::channel();
+                uint8_t channel = _network_list[_currentID].channel;
+                if (current && (current != channel)) {
+                    _channelChange(current, channel, _currentID);
+                }
+            }
+
+            _doSTA(_currentID);
+            _state = STATE_STA_ONGOING;
+            break;
+
+        case STATE_STA_ONGOING:
             {
                 uint8_t response = _doSTA();
                 if (RESPONSE_OK == response) {
                     _state = STATE_STA_SUCCESS;
                 } else if (RESPONSE_FAIL == response) {
-                    _state = STATE_STA_START;
-                    if (_scan) {
-                        _currentID = _network_list[_currentID].next;
-                        if (_currentID == 0xFF) {
-                            _state = STATE_STA_FAILED;
-                        }
-                    } else {
-                        _currentID++;
-                        if (_currentID == _network_list.size()) {
-                            _state = STATE_STA_FAILED;
-                        }
-                    }
+                    _state = _nextCandidate();
                 }
             }
             break;
@@ -548,44 +1456,52 @@ void JustWifi::_machine() {
             break;
 
         case STATE_STA_SUCCESS:
+            if (_warmup) {
+                _doWarmup(true);
+                _state = STATE_WARMUP;
+                break;
+            }
             _state = STATE_IDLE;
             break;
 
+        case STATE_WARMUP:
+            if (RESPONSE_WAIT != _doWarmup()) {
+                _state = STATE_IDLE;
+            }
+            break;
+
         // ---------------------------------------------------------------------
 
         #if defined(JUSTWIFI_ENABLE_WPS)
 
         case STATE_WPS_START:
+        {
 
-            _doCallback(MESSAGE_WPS_START);
-
-            _disable();
+            // Radio and SDK are configured in separate loop() calls
+            static uint8_t step = 0;
 
-            if (!WiFi.enableSTA(true)) {
-                _state = STATE_WPS_FAILED;
-                return;
+            if (0 == step) {
+                _provisioning = true;
+                _provision_start = millis();
+                _doCallback(MESSAGE_WPS_START);
+                step = 1;
             }
 
-            WiFi.disconnect();
-
-            if (!wifi_wps_disable()) {
-                _state = STATE_WPS_FAILED;
-                return;
-            }
+            if (1 == step) {
+                if (!backend::enableSTA(true)) {
+                    step = 0;
+                    _state = STATE_WPS_FAILED;
+                    return;
+                }
 
-            // so far only WPS_TYPE_PBC is supported (SDK 1.2.0)
-            if (!wifi_wps_enable(WPS_TYPE_PBC)) {
-                _state = STATE_WPS_FAILED;
-                return;
+                backend::disconnect();
+                step = 2;
+                break;
             }
 
-            _jw_wps_status = (wps_cb_status) 5;
-            if (!wifi_set_wps_cb((wps_st_cb_t) &_jw_wps_status_cb)) {
-                _state = STATE_WPS_FAILED;
-                return;
-            }
+            step = 0;
 
-            if (!wifi_wps_start()) {
+            if (!backend::wpsStart()) {
                 _state = STATE_WPS_FAILED;
                 return;
             }
@@ -593,27 +1509,32 @@ void JustWifi::_machine() {
             _state = STATE_WPS_ONGOING;
             break;
 
+        }
+
         case STATE_WPS_ONGOING:
-            if (5 == _jw_wps_status) {
-                // Still ongoing
-            } else if (WPS_CB_ST_SUCCESS == _jw_wps_status) {
-                _state = STATE_WPS_SUCCESS;
-            } else {
-                _state = STATE_WPS_FAILED;
+            {
+                auto status = backend::wpsStatus();
+                if (backend::Wps::Running == status) {
+                    // Still ongoing
+                } else if (backend::Wps::Success == status) {
+                    _state = STATE_WPS_SUCCESS;
+                } else {
+                    _state = STATE_WPS_FAILED;
+                }
             }
             break;
 
         case STATE_WPS_FAILED:
+            _provisioning = false;
             _doCallback(MESSAGE_WPS_ERROR);
-            wifi_wps_disable();
+            backend::wpsStop();
             _state = STATE_FALLBACK;
             break;
 
         case STATE_WPS_SUCCESS:
             _doCallback(MESSAGE_WPS_SUCCESS);
-            wifi_wps_disable();
-            addCurrentNetwork();
-            _state = STATE_IDLE;
+            backend::wpsStop();
+            _provisioned();
             break;
 
         #endif // defined(JUSTWIFI_ENABLE_WPS)
@@ -624,11 +1545,13 @@ void JustWifi::_machine() {
 
         case STATE_SMARTCONFIG_START:
 
+            _provisioning = true;
+            _provision_start = millis();
             _doCallback(MESSAGE_SMARTCONFIG_START);
 
-            enableAP(false);
+            _enableAP(false);
 
-            if (!WiFi.beginSmartConfig()) {
+            if (!backend::smartConfigStart()) {
                 _state = STATE_SMARTCONFIG_FAILED;
                 return;
             }
@@ -639,24 +1562,24 @@ void JustWifi::_machine() {
             break;
 
         case STATE_SMARTCONFIG_ONGOING:
-            if (WiFi.smartConfigDone()) {
+            if (backend::smartConfigDone()) {
                 _state = STATE_SMARTCONFIG_SUCCESS;
-            } else if (millis() - _start > JUSTWIFI_SMARTCONFIG_TIMEOUT) {
+            } else if (millis() - _start > _smartconfig_timeout) {
                 _state = STATE_SMARTCONFIG_FAILED;
             }
             break;
 
         case STATE_SMARTCONFIG_FAILED:
+            _provisioning = false;
             _doCallback(MESSAGE_SMARTCONFIG_ERROR);
-            WiFi.stopSmartConfig();
-            WiFi.enableSTA(false);
+            backend::smartConfigStop();
+            backend::enableSTA(false);
             _state = STATE_FALLBACK;
             break;
 
         case STATE_SMARTCONFIG_SUCCESS:
             _doCallback(MESSAGE_SMARTCONFIG_SUCCESS);
-            addCurrentNetwork();
-            _state = STATE_IDLE;
+            _provisioned();
             break;
 
         #endif // defined(JUSTWIFI_ENABLE_SMARTCONFIG)
@@ -669,6 +1592,21 @@ void JustWifi::_machine() {
             _state = STATE_IDLE;
             break;
 
+        // ---------------------------------------------------------------------
+
+        // Radio sleep state changes after returning from loop(), finish on the next call
+        case STATE_TURNING_OFF:
+            _doCallback(MESSAGE_TURNING_OFF);
+            _state = STATE_IDLE;
+            break;
+
+        case STATE_TURNING_ON:
+            _doCallback(MESSAGE_TURNING_ON);
+            backend::enableSTA(true);
+            _sta_enabled = true;
+            _state = STATE_IDLE;
+            break;
+
         default:
             _state = STATE_IDLE;
             break;
@@ -681,116 +1619,676 @@ void JustWifi::_machine() {
 // CONFIGURATION METHODS
 //------------------------------------------------------------------------------
 
-void JustWifi::cleanNetworks() {
-    for (auto& entry : _network_list) {
-        free(entry.ssid);
-        free(entry.pass);
-#if JUSTWIFI_ENABLE_ENTERPRISE
-        free(entry.enterprise_username);
-        free(entry.enterprise_password);
-#endif
+namespace {
+
+bool _same_string(const char* lhs, const char* rhs) {
+    if (!lhs || !rhs) return lhs == rhs;
+    return 0 == strcmp(lhs, rhs);
+}
+
+// Only what is needed to connect, learned data is not compared
+bool _same_settings(const network_t& lhs, const network_t& rhs) {
+    return _same_string(lhs.pass, rhs.pass)
+#if JUSTWIFI_ENABLE_ENTERPRISE
+        && _same_string(lhs.enterprise_username, rhs.enterprise_username)
+        && _same_string(lhs.enterprise_password, rhs.enterprise_password)
+#endif
+        && (lhs.dhcp == rhs.dhcp)
+        && (static_cast<uint32_t>(lhs.ip) == static_cast<uint32_t>(rhs.ip))
+        && (static_cast<uint32_t>(lhs.gw) == static_cast<uint32_t>(rhs.gw))
+        && (static_cast<uint32_t>(lhs.netmask) == static_cast<uint32_t>(rhs.netmask))
+        && (static_cast<uint32_t>(lhs.dns) == static_cast<uint32_t>(rhs.dns));
+}
+
+// Duty cycle state kept in RTC memory
+struct CycleRecord {
+    uint32_t magic;
+    uint32_t wakes;
+    justwifi_cycle_t last;
+    char ssid[33];
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
+constexpr uint32_t CycleMagic = 0x4a570001;
+
+static_assert(sizeof(CycleRecord) % 4 == 0, "RTC memory is written in 4 byte blocks");
+static_assert(sizeof(CycleRecord) <= JUSTWIFI_RTC_SIZE, "CycleRecord does not fit the RTC memory");
+
+bool _read_cycle(CycleRecord& record) {
+    if (!backend::rtcRead(&record, sizeof(record)) || (CycleMagic != record.magic)) {
+        std::memset(&record, 0, sizeof(record));
+        record.magic = CycleMagic;
+        return false;
+    }
+    record.ssid[sizeof(record.ssid) - 1] = '\0';
+    return true;
+}
+
+bool _can_set_credentials(const char* ssid, const char* pass) {
+    return ((ssid && *ssid != '\0' && strlen(ssid) <= JustWifi::SsidSizeMax) && (!pass || (strlen(pass) <= JustWifi::PassphraseSizeMax)));
+}
+
+bool _maybe_set_dhcp(network_t& network, const char* ip, const char* gw, const char* netmask) {
+    if (ip && gw && netmask
+        && *ip != '\0' && *gw != '\0' && *netmask != '\0') {
+        network.ip.fromString(ip);
+        network.gw.fromString(gw);
+        network.netmask.fromString(netmask);
+        return true;
+    }
+
+    return false;
+}
+
+void _free_network(network_t* network) {
+    free(network->ssid);
+    free(network->pass);
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    free(network->enterprise_username);
+    free(network->enterprise_password);
+#endif
+}
+
+bool _has_value(const char* value) {
+    return value && (*value != '\0');
+}
+
+// Borrows the strings, only for comparing and copying into an existing entry
+network_t _settings(const justwifi_network_config_t& config) {
+
+    network_t settings;
+    settings.pass = _has_value(config.pass) ? const_cast<char*>(config.pass) : nullptr;
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    if (_has_value(config.enterprise_username) && _has_value(config.enterprise_password)) {
+        settings.enterprise_username = const_cast<char*>(config.enterprise_username);
+        settings.enterprise_password = const_cast<char*>(config.enterprise_password);
+    }
+#endif
+    settings.dhcp = !_maybe_set_dhcp(settings, config.ip, config.gw, config.netmask);
+    if (_has_value(config.dns)) {
+        settings.dns.fromString(config.dns);
+    }
+
+    return settings;
+
+}
+
+// Reuses the current buffer when the new value fits. Old value is kept when out of memory
+void _assign(char*& field, const char* value) {
+
+    if (!value) {
+        free(field);
+        field = nullptr;
+        return;
+    }
+
+    size_t length = strlen(value);
+    if (field && (strlen(field) >= length)) {
+        std::memcpy(field, value, length + 1);
+        return;
+    }
+
+    char* copy = strdup(value);
+    if (copy) {
+        free(field);
+        field = copy;
+    }
+
+}
+
+size_t _string_size(const char* value) {
+    return value ? strlen(value) + 1 : 0;
+}
+
+const char* _copy_string(char*& buffer, const char* value) {
+    if (!value) return nullptr;
+    size_t size = strlen(value) + 1;
+    std::memcpy(buffer, value, size);
+    const char* result = buffer;
+    buffer += size;
+    return result;
+}
+
+} // namespace
+
+// Allocated by the caller and passed through the command queue, owned by the list after that
+network_t * JustWifi::_makeNetwork(
+    const char * ssid,
+    const char * pass,
+    const char * ip,
+    const char * gw,
+    const char * netmask,
+    const char * dns
+) {
+
+    if (!_can_set_credentials(ssid, pass)) {
+        return nullptr;
+    }
+
+    auto* new_network = new (std::nothrow) network_t;
+    if (!new_network) {
+        return nullptr;
+    }
+
+    // Copy SSID and PASS directly, as strings Arduino API expects
+
+    new_network->ssid = strdup(ssid);
+    if (!new_network->ssid) {
+        delete new_network;
+        return nullptr;
+    }
+
+    if (pass && *pass != '\0') {
+        new_network->pass = strdup(pass);
+        if (!new_network->pass) {
+            _free_network(new_network);
+            delete new_network;
+            return nullptr;
+        }
+    }
+
+    // normal network will set dhcp flag when ip, gw and netmask are not set
+    new_network->dhcp = !_maybe_set_dhcp(*new_network, ip, gw, netmask);
+    if (dns && *dns != '\0') {
+        new_network->dns.fromString(dns);
+    }
+
+    return new_network;
+
+}
+
+bool JustWifi::_addNetwork(network_t * network) {
+
+    JUSTWIFI_PROFILE(PROFILE_NETWORKS);
+
+    if (!network) return false;
+
+    if (_network_list.size() >= JUSTWIFI_NETWORKS_MAX) {
+        _free_network(network);
+        delete network;
+        return false;
+    }
+
+    _network_list.push_back(*network);
+    delete network;
+    return true;
+
+}
+
+void JustWifi::_setPower(network_t * network) {
+
+    if (!network) return;
+
+    for (auto& entry : _network_list) {
+        if (0 == strcmp(entry.ssid, network->ssid)) {
+            entry.power = network->power;
+            entry.power_set = true;
+        }
+    }
+
+    _free_network(network);
+    delete network;
+
+}
+
+uint8_t JustWifi::_findNetwork(const char * ssid) {
+    for (uint8_t id = 0; id < _network_list.size(); ++id) {
+        if (0 == strcmp(_network_list[id].ssid, ssid)) return id;
+    }
+    return 0xFF;
+}
+
+// Connected to it or trying to
+bool JustWifi::_networkBusy(uint8_t id) {
+    if (_sta_session && (_stats_id == id)) return true;
+    return ((STATE_STA_START == _state) || (STATE_STA_ONGOING == _state)) && (_currentID == id);
+}
+
+// Leave the network and start over right away, without waiting for the reconnect interval
+void JustWifi::_dropNetwork(uint8_t id) {
+
+    if (!_networkBusy(id)) return;
+
+    bool connected = _sta_session;
+    _finishSession();
+    _stats_id = 0xFF;
+    backend::disconnect();
+
+    _timeout = 0;
+    _state = STATE_IDLE;
+
+    if (connected) {
+        _doCallback(MESSAGE_DISCONNECTED, _network_list[id].ssid);
+    }
+
+}
+
+// Existing strings are kept when they did not change, and overwritten when the new value fits
+void JustWifi::_updateNetwork(const justwifi_network_config_t& config) {
+
+    uint8_t id = _findNetwork(config.ssid);
+    if (0xFF == id) {
+        auto* network = _makeNetwork(config);
+        if (network) {
+            network->applied = true;
+            _addNetwork(network);
+        }
+        return;
+    }
+
+    auto& entry = _network_list[id];
+    entry.applied = true;
+
+    network_t settings = _settings(config);
+    if (_same_settings(entry, settings)) return;
+
+    _assign(entry.pass, settings.pass);
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    _assign(entry.enterprise_username, settings.enterprise_username);
+    _assign(entry.enterprise_password, settings.enterprise_password);
+#endif
+    entry.dhcp = settings.dhcp;
+    entry.ip = settings.ip;
+    entry.gw = settings.gw;
+    entry.netmask = settings.netmask;
+    entry.dns = settings.dns;
+    _dropNetwork(id);
+
+}
+
+// Networks missing from the set are removed when replacing the whole list
+void JustWifi::_updateNetworks(network_set_t * set, bool replace) {
+
+    JUSTWIFI_PROFILE(PROFILE_NETWORKS);
+
+    if (!set) return;
+
+    // Networks left out are removed first, so the new ones fit in JUSTWIFI_NETWORKS_MAX
+    if (replace) {
+        for (auto& entry : _network_list) {
+            entry.applied = false;
+        }
+        for (size_t index = 0; index < set->count; ++index) {
+            uint8_t id = _findNetwork(set->networks[index].ssid);
+            if (0xFF != id) _network_list[id].applied = true;
+        }
+        for (uint8_t id = _network_list.size(); id > 0; --id) {
+            if (!_network_list[id - 1].applied) {
+                _removeNetwork(id - 1);
+            }
+        }
+    }
+
+    for (size_t index = 0; index < set->count; ++index) {
+        _updateNetwork(set->networks[index]);
+    }
+
+    free(set);
+
+}
+
+void JustWifi::_removeNetwork(network_t * network) {
+
+    if (!network) return;
+
+    uint8_t id = _findNetwork(network->ssid);
+    if (0xFF != id) {
+        _removeNetwork(id);
+    }
+
+    _free_network(network);
+    delete network;
+
+}
+
+void JustWifi::_removeNetwork(uint8_t id) {
+
+    JUSTWIFI_PROFILE(PROFILE_NETWORKS);
+
+    _dropNetwork(id);
+
+    // Unlink from the candidates order, then shift every index after it
+    uint8_t next = _network_list[id].next;
+    _free_network(&_network_list[id]);
+    _network_list.erase(_network_list.begin() + id);
+
+    auto shift = [id](uint8_t& index) {
+        if ((0xFF != index) && (index > id)) --index;
+    };
+
+    for (auto& entry : _network_list) {
+        if (entry.next == id) entry.next = next;
+        shift(entry.next);
+    }
+
+    if (_stats_id == id) {
+        _stats_id = 0xFF;
+    } else {
+        shift(_stats_id);
+    }
+
+    if (_last_id == id) {
+        _last_id = 0xFF;
+    } else {
+        shift(_last_id);
+    }
+
+    if (_currentID == id) {
+        _currentID = 0;
+    } else {
+        shift(_currentID);
+    }
+
+}
+
+void JustWifi::_startCycle() {
+
+    _cycle = true;
+    _cycle_fast = false;
+    _cycle_current = {};
+    _cycle_start = millis();
+
+    CycleRecord record;
+    if (_read_cycle(record)) {
+        _cycle_last = record.last;
+    }
+
+    // Join the same access point as the last time, without scanning
+    uint8_t id = record.channel ? _findNetwork(record.ssid) : 0xFF;
+    if (0xFF != id) {
+        auto& entry = _network_list[id];
+        entry.channel = record.channel;
+        std::memcpy(entry.bssid, record.bssid, sizeof(entry.bssid));
+        _cycle_fast = true;
+        _currentID = id;
+        _state = STATE_STA_START;
+        return;
+    }
+
+    _currentID = 0;
+    _state = _useScan() ? STATE_SCAN_START : STATE_STA_START;
+
+}
+
+// Runs before the state machine, so it sees STATE_STA_FAILED before the fallback does
+void JustWifi::_doCycle() {
+
+    if (!_cycle) return;
+
+    // Stored channel and BSSID did not work, look for the network the usual way
+    if ((STATE_STA_FAILED == _state) && _cycle_fast) {
+        _cycle_fast = false;
+        _currentID = 0;
+        _state = _useScan() ? STATE_SCAN_START : STATE_STA_START;
+        return;
+    }
+
+    // Send once, then give the stack time to transmit before the radio goes off
+    if ((STATE_IDLE == _state) && _sta_session) {
+        if (!_cycle_current.ready) {
+            _cycle_current.ready = millis();
+            _cycle_current.fast = _cycle_fast;
+            if (_cycle_send) {
+                _cycle_send();
+                _cycle_current.sent = true;
+            }
+            _cycle_flush = millis();
+            return;
+        }
+        if (millis() - _cycle_flush >= JUSTWIFI_CYCLE_FLUSH) {
+            _cycleSleep(true);
+        }
+        return;
+    }
+
+    if ((STATE_STA_FAILED == _state) || (STATE_FALLBACK == _state) || (millis() - _cycle_start > _cycle_timeout)) {
+        _cycleSleep(false);
+    }
+
+}
+
+void JustWifi::_cycleSleep(bool connected) {
+
+    // Ready time and send are kept when the link dropped while flushing
+    justwifi_cycle_t current = _cycle_current;
+
+    CycleRecord record;
+    _read_cycle(record);
+    ++record.wakes;
+
+    // Next wake scans when this one did not connect
+    record.channel = 0;
+    if (connected) {
+        if (_stats_id < _network_list.size()) {
+            strncpy(record.ssid, _network_list[_stats_id].ssid, sizeof(record.ssid) - 1);
+            std::memcpy(record.bssid, backend::bssid(), sizeof(record.bssid));
+            record.channel = backend::channel();
+        }
+    }
+
+    _finishSession();
+    _stats_id = 0xFF;
+    backend::disconnect();
+    backend::off();
+
+    current.awake = millis();
+    record.last = current;
+    backend::rtcWrite(&record, sizeof(record));
+
+    char buffer[64];
+    snprintf_P(buffer, sizeof(buffer), PSTR("AWAKE: %u, READY: %u, FAST: %u, SENT: %u"),
+        current.awake, current.ready, current.fast, current.sent);
+    _doCallback(MESSAGE_CYCLE_SLEEP, buffer);
+
+    _cycle = false;
+    _cycle_last = current;
+    _state = STATE_IDLE;
+
+    bool calibrate = JUSTWIFI_CYCLE_CALIBRATE && (0 == (record.wakes % JUSTWIFI_CYCLE_CALIBRATE));
+    backend::deepSleep(_cycle_sleep, calibrate);
+
+}
+
+void JustWifi::_cleanNetworks() {
+
+    JUSTWIFI_PROFILE(PROFILE_NETWORKS);
+
+    // Leave the network in use the same way removeNetwork() does
+    for (uint8_t id = 0; id < _network_list.size(); ++id) {
+        _dropNetwork(id);
+    }
+
+    _finishSession();
+    _stats_id = 0xFF;
+    _last_id = 0xFF;
+    _currentID = 0;
+
+    for (auto& entry : _network_list) {
+        _free_network(&entry);
+    }
+    _network_list.clear();
+
+}
+
+bool JustWifi::cleanNetworks() {
+    return _post(COMMAND_CLEAN_NETWORKS);
+}
+
+bool JustWifi::addNetwork(
+    const char * ssid,
+    const char * pass,
+    const char * ip,
+    const char * gw,
+    const char * netmask,
+    const char * dns
+) {
+
+    auto* network = _makeNetwork(ssid, pass, ip, gw, netmask, dns);
+    if (!network) {
+        return false;
     }
-    _network_list.clear();
-}
 
-namespace {
+    return _post(COMMAND_ADD_NETWORK, false, network);
 
-bool _can_set_credentials(const char* ssid, const char* pass) {
-    return ((ssid && *ssid != '\0' && strlen(ssid) <= JustWifi::SsidSizeMax) && (!pass || (strlen(pass) <= JustWifi::PassphraseSizeMax)));
 }
 
-bool _maybe_set_dhcp(network_t& network, const char* ip, const char* gw, const char* netmask) {
-    if (ip && gw && netmask
-        && *ip != '\0' && *gw != '\0' && *netmask != '\0') {
-        network.ip.fromString(ip);
-        network.gw.fromString(gw);
-        network.netmask.fromString(netmask);
-        return true;
-    }
+#if JUSTWIFI_ENABLE_ENTERPRISE
 
-    return false;
+void JustWifi::setEnterpriseCACert(const char * pem) {
+    backend::enterpriseCACert(pem);
 }
 
-} // namespace
-
-bool JustWifi::addNetwork(
+bool JustWifi::addEnterpriseNetwork(
     const char * ssid,
-    const char * pass,
+    const char * enterprise_username,
+    const char * enterprise_password,
     const char * ip,
     const char * gw,
     const char * netmask,
     const char * dns
 ) {
+    if (!enterprise_username \
+        || !enterprise_password \
+        || *enterprise_username == '\0' \
+        || *enterprise_password == '\0'
+    ) {
+        return false;
+    }
 
-    if (!_can_set_credentials(ssid, pass)) {
+    auto* network = _makeNetwork(ssid, nullptr, ip, gw, netmask, dns);
+    if (!network) {
         return false;
     }
 
-    network_t new_network;
+    network->enterprise_username = strdup(enterprise_username);
+    network->enterprise_password = strdup(enterprise_password);
 
-    // Copy SSID and PASS directly, as strings Arduino API expects
+    return _post(COMMAND_ADD_NETWORK, false, network);
+}
 
-    new_network.ssid = strdup(ssid);
-    if (!new_network.ssid) {
-        return false;
+#endif // JUSTWIFI_ENABLE_ENTERPRISE
+
+network_t * JustWifi::_makeNetwork(const justwifi_network_config_t& config) {
+
+    auto* network = _makeNetwork(config.ssid, config.pass, config.ip, config.gw, config.netmask, config.dns);
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    if (network \
+        && config.enterprise_username && *config.enterprise_username != '\0' \
+        && config.enterprise_password && *config.enterprise_password != '\0'
+    ) {
+        network->enterprise_username = strdup(config.enterprise_username);
+        network->enterprise_password = strdup(config.enterprise_password);
     }
+#endif
 
-    if (pass && *pass != '\0') {
-        new_network.pass = strdup(pass);
-        if (!new_network.pass) {
-            free(new_network.ssid);
-            return false;
+    return network;
+
+}
+
+// Single allocation, so the whole set goes through the queue as one command.
+// Nothing is allocated when any of the networks is not valid
+JustWifi::network_set_t * JustWifi::_makeNetworkSet(const justwifi_network_config_t * networks, size_t count) {
+
+    if ((!networks && count) || (count > JUSTWIFI_NETWORKS_MAX)) {
+        return nullptr;
+    }
+
+    size_t size = sizeof(network_set_t) + count * sizeof(justwifi_network_config_t);
+    for (size_t index = 0; index < count; ++index) {
+        const auto& config = networks[index];
+        if (!_can_set_credentials(config.ssid, config.pass)) {
+            return nullptr;
         }
+        size += _string_size(config.ssid) + _string_size(config.pass)
+            + _string_size(config.ip) + _string_size(config.gw)
+            + _string_size(config.netmask) + _string_size(config.dns);
+#if JUSTWIFI_ENABLE_ENTERPRISE
+        size += _string_size(config.enterprise_username) + _string_size(config.enterprise_password);
+#endif
     }
 
-    // normal network will set dhcp flag when ip, gw and netmask are not set
-    new_network.dhcp = !_maybe_set_dhcp(new_network, ip, gw, netmask);
-    if (dns && *dns != '\0') {
-        new_network.dns.fromString(dns);
+    auto* set = static_cast<network_set_t*>(malloc(size));
+    if (!set) {
+        return nullptr;
     }
 
-    _network_list.push_back(new_network);
+    set->count = count;
+    set->networks = reinterpret_cast<justwifi_network_config_t*>(set + 1);
+
+    char* buffer = reinterpret_cast<char*>(set->networks + count);
+    for (size_t index = 0; index < count; ++index) {
+        const auto& config = networks[index];
+        auto& copy = set->networks[index];
+        copy.ssid = _copy_string(buffer, config.ssid);
+        copy.pass = _copy_string(buffer, config.pass);
+        copy.ip = _copy_string(buffer, config.ip);
+        copy.gw = _copy_string(buffer, config.gw);
+        copy.netmask = _copy_string(buffer, config.netmask);
+        copy.dns = _copy_string(buffer, config.dns);
+#if JUSTWIFI_ENABLE_ENTERPRISE
+        copy.enterprise_username = _copy_string(buffer, config.enterprise_username);
+        copy.enterprise_password = _copy_string(buffer, config.enterprise_password);
+#endif
+    }
 
-    return true;
+    return set;
 
 }
 
-#if JUSTWIFI_ENABLE_ENTERPRISE
-
-bool JustWifi::addEnterpriseNetwork(
+bool JustWifi::updateNetwork(
     const char * ssid,
-    const char * enterprise_username,
-    const char * enterprise_password,
+    const char * pass,
     const char * ip,
     const char * gw,
     const char * netmask,
     const char * dns
 ) {
-    if (!enterprise_username \
-        || !enterprise_password \
-        || *enterprise_username == '\0' \
-        || *enterprise_password == '\0'
-    ) {
+
+    justwifi_network_config_t config {};
+    config.ssid = ssid;
+    config.pass = pass;
+    config.ip = ip;
+    config.gw = gw;
+    config.netmask = netmask;
+    config.dns = dns;
+
+    auto* set = _makeNetworkSet(&config, 1);
+    if (!set) {
         return false;
     }
 
-    if (!addNetwork(ssid, nullptr, ip, gw, netmask, dns)) {
+    return _post(COMMAND_UPDATE_NETWORK, false, nullptr, set);
+
+}
+
+bool JustWifi::removeNetwork(const char * ssid) {
+
+    auto* network = _makeNetwork(ssid);
+    if (!network) {
         return false;
     }
 
-    auto& network = _network_list.back();
-    network.enterprise_username = strdup(enterprise_username);
-    network.enterprise_password = strdup(enterprise_password);
+    return _post(COMMAND_REMOVE_NETWORK, false, network);
 
-    return true;
 }
 
-#endif // JUSTWIFI_ENABLE_ENTERPRISE
+bool JustWifi::applyNetworks(const justwifi_network_config_t * networks, size_t count) {
+
+    auto* set = _makeNetworkSet(networks, count);
+    if (!set) {
+        return false;
+    }
+
+    return _post(COMMAND_APPLY_NETWORKS, false, nullptr, set);
+
+}
 
 bool JustWifi::addCurrentNetwork() {
     return addNetwork(
-        WiFi.SSID().c_str(),
-        WiFi.psk().c_str(),
+        backend::ssid().c_str(),
+        backend::psk().c_str(),
         nullptr, nullptr, nullptr, nullptr
     );
 }
@@ -803,39 +2301,48 @@ bool JustWifi::setSoftAP(
     const char * netmask
 ) {
 
-    if (!_can_set_credentials(ssid, pass)) {
+    auto* network = _makeNetwork(ssid, pass, ip, gw, netmask);
+    if (!network) {
         return false;
     }
 
+    return _post(COMMAND_SET_SOFTAP, false, network);
+
+}
+
+void JustWifi::_setSoftAP(network_t * network) {
+
     _softap.ssid = _ap_ssid;
-    std::memcpy(_softap.ssid, ssid, std::min(sizeof(_ap_ssid), strlen(ssid) + 1));
+    std::memcpy(_softap.ssid, network->ssid, std::min(sizeof(_ap_ssid), strlen(network->ssid) + 1));
 
-    if (pass && *pass != '\0') {
+    _softap.pass = nullptr;
+    if (network->pass) {
         _softap.pass = _ap_pass;
-        std::memcpy(_softap.pass, pass, std::min(sizeof(_ap_pass), strlen(pass) + 1));
+        std::memcpy(_softap.pass, network->pass, std::min(sizeof(_ap_pass), strlen(network->pass) + 1));
     }
 
     // softap sets dhcp flag when ip, gw and netmask are set
     // (meaning, we will propogate those via DHCP)
-    _softap.dhcp = _maybe_set_dhcp(_softap, ip, gw, netmask);
+    _softap.dhcp = !network->dhcp;
+    _softap.ip = network->ip;
+    _softap.gw = network->gw;
+    _softap.netmask = network->netmask;
 
     // https://github.com/xoseperez/justwifi/issues/4
-    if ((WiFi.getMode() & WIFI_AP) > 0) {
-        if (_softap.pass) {
-            WiFi.softAP(_softap.ssid, _softap.pass);
-        } else {
-            WiFi.softAP(_softap.ssid);
-        }
+    if ((backend::mode() & WIFI_AP) > 0) {
+        backend::softAP(_softap.ssid, _softap.pass, backend::softAPChannel());
     }
 
-    return true;
-
 }
 
 void JustWifi::setConnectTimeout(unsigned long ms) {
     _connect_timeout = ms;
 }
 
+void JustWifi::setSmartConfigTimeout(unsigned long ms) {
+    _smartconfig_timeout = ms;
+}
+
 void JustWifi::setReconnectTimeout(unsigned long ms) {
     _reconnect_timeout = ms;
 }
@@ -845,11 +2352,19 @@ void JustWifi::resetReconnectTimeout() {
 }
 
 void JustWifi::setHostname(const char * hostname) {
-    strncpy(_hostname, hostname, sizeof(_hostname));
+    strncpy(_hostname, hostname, sizeof(_hostname) - 1);
+    _hostname[sizeof(_hostname) - 1] = '\0';
 }
 
-void JustWifi::subscribe(callback_type callback) {
-    _callbacks.push_back(callback);
+bool JustWifi::subscribe(callback_type callback) {
+    command_t command {};
+    command.type = COMMAND_SUBSCRIBE;
+    command.callback = callback;
+    return _post(command);
+}
+
+void JustWifi::setScoring(score_type scoring) {
+    _scoring = scoring ? scoring : defaultScore;
 }
 
 //------------------------------------------------------------------------------
@@ -857,7 +2372,7 @@ void JustWifi::subscribe(callback_type callback) {
 //------------------------------------------------------------------------------
 
 wl_status_t JustWifi::getStatus() {
-    return WiFi.status();
+    return backend::status();
 }
 
 String JustWifi::getAPSSID() {
@@ -865,79 +2380,546 @@ String JustWifi::getAPSSID() {
 }
 
 bool JustWifi::connected() {
-    return (WiFi.status() == WL_CONNECTED);
+    return (backend::status() == WL_CONNECTED);
 }
 
 bool JustWifi::connectable() {
     return _ap_connected;
 }
 
-void JustWifi::disconnect() {
+bool JustWifi::setHealthCheck(unsigned long interval, uint8_t misses) {
+    command_t command {};
+    command.type = COMMAND_HEALTH_CHECK;
+    command.value = interval;
+    command.misses = misses;
+    return _post(command);
+}
+
+void JustWifi::_setHealthCheck(unsigned long interval, uint8_t misses) {
+    _health_interval = interval;
+    _health_misses = misses ? misses : 1;
+    _health_pending = false;
+    if (!interval) backend::probeStop();
+}
+
+bool JustWifi::setChannelLock(uint16_t channels) {
+    command_t command {};
+    command.type = COMMAND_LOCK_CHANNELS;
+    command.value = channels & ((1u << JUSTWIFI_CHANNELS) - 1);
+    return _post(command);
+}
+
+void JustWifi::setScanSlices(uint8_t channels, uint32_t dwell, uint32_t gap, bool background) {
+    _slice_channels = channels;
+    _slice_dwell = dwell;
+    _slice_gap = gap;
+    _slice_background = background;
+}
+
+const justwifi_scan_stats_t& JustWifi::getScanStats() {
+    return _scan_stats;
+}
+
+void JustWifi::resetScanStats() {
+    _scan_stats = justwifi_scan_stats_t{};
+}
+
+void JustWifi::setRSSIFilter(uint8_t weight, uint8_t misses) {
+    _rssi_weight = std::max<uint8_t>(std::min<uint8_t>(weight, 100), 1);
+    _rssi_misses = misses;
+}
+
+void JustWifi::setPowerPolicy(const justwifi_power_t& policy) {
+    _power_policy = policy;
+}
+
+bool JustWifi::setPowerPolicy(const char * ssid, const justwifi_power_t& policy) {
+    auto* network = _makeNetwork(ssid);
+    if (!network) return false;
+    network->power = policy;
+    network->power_set = true;
+    return _post(COMMAND_SET_POWER, false, network);
+}
+
+const justwifi_power_stats_t& JustWifi::getPowerStats() {
+    return _power_stats;
+}
+
+void JustWifi::resetPowerStats() {
+    uint8_t tx_power = _power_stats.tx_power;
+    _power_stats = justwifi_power_stats_t{};
+    _power_stats.tx_power = tx_power;
+    _power_remainder = 0;
+}
+
+unsigned long JustWifi::getProvisioningTime() {
+    return _provision_time;
+}
+
+void JustWifi::enableWarmup(bool enabled) {
+    _warmup = enabled;
+}
+
+void JustWifi::setWarmup(const char * const * hosts, size_t count, const char * ntp) {
+    _warmup_hosts = hosts;
+    _warmup_count = hosts ? count : 0;
+    _warmup_ntp = ntp;
+    _warmup = true;
+}
+
+unsigned long JustWifi::getReadyTime() {
+    return _ready_time;
+}
+
+bool JustWifi::startCycle(send_type send, uint64_t sleep_us, unsigned long timeout) {
+    command_t command {};
+    command.type = COMMAND_START_CYCLE;
+    command.send = send;
+    command.sleep = sleep_us;
+    command.value = timeout;
+    return _post(command);
+}
+
+const justwifi_cycle_t& JustWifi::getLastCycle() {
+    return _cycle_last;
+}
+
+justwifi::NetworkRange JustWifi::networks() const {
+    // Never more than JUSTWIFI_NETWORKS_MAX, see _addNetwork()
+    return justwifi::NetworkRange(_network_list.data(), static_cast<uint8_t>(_network_list.size()));
+}
+
+justwifi::NetworkView JustWifi::getNetwork(uint8_t id) const {
+    if (id >= _network_list.size()) return justwifi::NetworkView();
+    return justwifi::NetworkView(&_network_list[id], id);
+}
+
+justwifi::NetworkView JustWifi::getActiveNetwork() const {
+    if (!_sta_session) return justwifi::NetworkView();
+    return getNetwork(_stats_id);
+}
+
+justwifi::NetworkView JustWifi::getCandidateNetwork() const {
+    if ((STATE_STA_START != _state) && (STATE_STA_ONGOING != _state)) return justwifi::NetworkView();
+    return getNetwork(_currentID);
+}
+
+const network_stats_t* JustWifi::getStats(uint8_t id) {
+    if (id >= _network_list.size()) return nullptr;
+    return &_network_list[id].stats;
+}
+
+uint8_t JustWifi::reasonIndex(uint8_t reason) {
+    if ((reason >= 1) && (reason <= 24)) return reason;
+    if ((reason >= 200) && (reason <= 204)) return reason - 175;
+    return 0;
+}
+
+uint8_t JustWifi::reasonFromIndex(uint8_t index) {
+    if ((index >= 1) && (index <= 24)) return index;
+    if ((index >= 25) && (index < JUSTWIFI_DISCONNECT_REASONS)) return index + 175;
+    return 0;
+}
+
+void JustWifi::_disconnect() {
+    // Explicit disconnection is not counted as a dropped session
+    _finishSession();
+    _stats_id = 0xFF;
     _timeout = 0;
-    WiFi.disconnect();
-    WiFi.enableSTA(false);
+    backend::disconnect();
+    backend::enableSTA(false);
     _doCallback(MESSAGE_DISCONNECTED);
 }
 
-void JustWifi::turnOff() {
-    WiFi.disconnect();
-    WiFi.enableAP(false);
-    WiFi.enableSTA(false);
-    WiFi.forceSleepBegin();
-    delay(1);
-    _doCallback(MESSAGE_TURNING_OFF);
+void JustWifi::_turnOff() {
+    _finishSession();
+    _stats_id = 0xFF;
+    backend::disconnect();
+    backend::enableAP(false);
+    backend::enableSTA(false);
+    backend::sleep();
     _sta_enabled = false;
-    _state = STATE_IDLE;
+    _state = STATE_TURNING_OFF;
 }
 
-void JustWifi::turnOn() {
-    WiFi.forceSleepWake();
-    delay(1);
+void JustWifi::_turnOn() {
+    backend::wake();
     setReconnectTimeout(0);
-    _doCallback(MESSAGE_TURNING_ON);
-    WiFi.enableSTA(true);
-    _sta_enabled = true;
-    _state = STATE_IDLE;
+    _state = STATE_TURNING_ON;
+}
+
+void JustWifi::_enableAP(bool enabled) {
+    if (enabled) {
+        _doAP();
+    } else {
+        backend::softAPStop();
+        _ap_connected = false;
+        _doCallback(MESSAGE_ACCESSPOINT_DESTROYED);
+    }
+}
+
+bool JustWifi::disconnect() {
+    return _post(COMMAND_DISCONNECT);
+}
+
+bool JustWifi::turnOff() {
+    return _post(COMMAND_TURN_OFF);
+}
+
+bool JustWifi::turnOn() {
+    return _post(COMMAND_TURN_ON);
 }
 
 #if defined(JUSTWIFI_ENABLE_WPS)
-void JustWifi::startWPS() {
-    _state = STATE_WPS_START;
+bool JustWifi::startWPS() {
+    return _post(COMMAND_START_WPS);
 }
 #endif // defined(JUSTWIFI_ENABLE_WPS)
 
 #if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
-void JustWifi::startSmartConfig() {
-    _state = STATE_SMARTCONFIG_START;
+bool JustWifi::startSmartConfig() {
+    return _post(COMMAND_START_SMARTCONFIG);
 }
 #endif // defined(JUSTWIFI_ENABLE_SMARTCONFIG)
 
-void JustWifi::enableSTA(bool enabled) {
-    _sta_enabled = enabled;
+bool JustWifi::enableSTA(bool enabled) {
+    return _post(COMMAND_ENABLE_STA, enabled);
 }
 
-void JustWifi::enableAP(bool enabled) {
-    if (enabled) {
-        _doAP();
-    } else {
-        WiFi.softAPdisconnect();
-        WiFi.enableAP(false);
-        _ap_connected = false;
-        _doCallback(MESSAGE_ACCESSPOINT_DESTROYED);
+bool JustWifi::enableAP(bool enabled) {
+    return _post(COMMAND_ENABLE_AP, enabled);
+}
+
+bool JustWifi::_post(justwifi_commands_t type, bool enabled, network_t * network, network_set_t * set) {
+    command_t command {};
+    command.type = type;
+    command.enabled = enabled;
+    command.network = network;
+    command.set = set;
+    return _post(command);
+}
+
+bool JustWifi::_post(command_t& command) {
+
+    // Nothing else touches the list before the first loop(), no need to wait for it
+    if (!_running) {
+        _doCommand(command);
+        return true;
+    }
+
+    if (_commands.push(command)) {
+        backend::taskNotify();
+        return true;
+    }
+
+    _freeCommand(command);
+    return false;
+
+}
+
+void JustWifi::_freeCommand(command_t& command) {
+    if (command.network) {
+        _free_network(command.network);
+        delete command.network;
+    }
+    free(command.set);
+}
+
+void JustWifi::_doCommands() {
+
+    command_t command;
+    while (_commands.pop(command)) {
+        _doCommand(command);
+        if (_overBudget()) break;
+    }
+
+}
+
+void JustWifi::_doCommand(command_t& command) {
+
+    const char* name = "";
+
+    switch (command.type) {
+    case COMMAND_ADD_NETWORK:
+        _addNetwork(command.network);
+        name = "ADD_NETWORK";
+        break;
+    case COMMAND_CLEAN_NETWORKS:
+        _cleanNetworks();
+        name = "CLEAN_NETWORKS";
+        break;
+    case COMMAND_ENABLE_STA:
+        _sta_enabled = command.enabled;
+        name = "ENABLE_STA";
+        break;
+    case COMMAND_ENABLE_AP:
+        _enableAP(command.enabled);
+        name = "ENABLE_AP";
+        break;
+    case COMMAND_DISCONNECT:
+        _disconnect();
+        name = "DISCONNECT";
+        break;
+    case COMMAND_TURN_OFF:
+        _turnOff();
+        name = "TURN_OFF";
+        break;
+    case COMMAND_TURN_ON:
+        _turnOn();
+        name = "TURN_ON";
+        break;
+    case COMMAND_START_WPS:
+#if defined(JUSTWIFI_ENABLE_WPS)
+        _state = STATE_WPS_START;
+#endif
+        name = "START_WPS";
+        break;
+    case COMMAND_START_SMARTCONFIG:
+#if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+        _state = STATE_SMARTCONFIG_START;
+#endif
+        name = "START_SMARTCONFIG";
+        break;
+    case COMMAND_SET_POWER:
+        _setPower(command.network);
+        name = "SET_POWER";
+        break;
+    case COMMAND_UPDATE_NETWORK:
+        _updateNetworks(command.set, false);
+        name = "UPDATE_NETWORK";
+        break;
+    case COMMAND_REMOVE_NETWORK:
+        _removeNetwork(command.network);
+        name = "REMOVE_NETWORK";
+        break;
+    case COMMAND_APPLY_NETWORKS:
+        _updateNetworks(command.set, true);
+        name = "APPLY_NETWORKS";
+        break;
+    case COMMAND_START_CYCLE:
+        _cycle_send = command.send;
+        _cycle_sleep = command.sleep;
+        _cycle_timeout = command.value;
+        _startCycle();
+        name = "START_CYCLE";
+        break;
+    case COMMAND_LOCK_CHANNELS:
+        _lockChannels(command.value);
+        name = "LOCK_CHANNELS";
+        break;
+    case COMMAND_SET_SOFTAP:
+        _setSoftAP(command.network);
+        _freeCommand(command);
+        name = "SET_SOFTAP";
+        break;
+    case COMMAND_HEALTH_CHECK:
+        _setHealthCheck(command.value, command.misses);
+        name = "HEALTH_CHECK";
+        break;
+    case COMMAND_SUBSCRIBE:
+        _callbacks.push_back(command.callback);
+        name = "SUBSCRIBE";
+        break;
     }
+
+    char buffer[24];
+    snprintf_P(buffer, sizeof(buffer), PSTR("%s"), name);
+    _doCallback(MESSAGE_COMMAND_DONE, buffer);
+
 }
 
 void JustWifi::enableAPFallback(bool enabled) {
     _ap_fallback_enabled = enabled;
 }
 
+void JustWifi::enableAPCoexistence(bool enabled) {
+    _ap_coexistence = enabled;
+}
+
 
 void JustWifi::enableScan(bool scan) {
     _scan = scan;
 }
 
+size_t JustWifi::traceCount() {
+#if JUSTWIFI_TRACE_SIZE
+    return _trace_count;
+#else
+    return 0;
+#endif
+}
+
+void JustWifi::traceEach(trace_callback_type callback) {
+#if JUSTWIFI_TRACE_SIZE
+    size_t index = (_trace_head + JUSTWIFI_TRACE_SIZE - _trace_count) % JUSTWIFI_TRACE_SIZE;
+    for (size_t n = 0; n < _trace_count; ++n) {
+        callback(_trace_buffer[index]);
+        index = (index + 1) % JUSTWIFI_TRACE_SIZE;
+    }
+#else
+    (void) callback;
+#endif
+}
+
+void JustWifi::traceDump(Print& out) {
+#if JUSTWIFI_TRACE_SIZE
+    size_t index = (_trace_head + JUSTWIFI_TRACE_SIZE - _trace_count) % JUSTWIFI_TRACE_SIZE;
+    for (size_t n = 0; n < _trace_count; ++n) {
+        const auto& record = _trace_buffer[index];
+        char buffer[80];
+        snprintf_P(buffer, sizeof(buffer), PSTR("%10u %2u>%2u MSG: %3u NET: %3u RSSI: %4d STATUS: %3u\n"),
+            static_cast<unsigned>(record.timestamp),
+            record.state, record.next_state,
+            record.message, record.network,
+            record.rssi, record.status
+        );
+        out.print(buffer);
+        index = (index + 1) % JUSTWIFI_TRACE_SIZE;
+    }
+#else
+    (void) out;
+#endif
+}
+
+void JustWifi::traceDumpRaw(Print& out) {
+#if JUSTWIFI_TRACE_SIZE
+    const uint32_t header[2] {
+        static_cast<uint32_t>(_trace_head),
+        static_cast<uint32_t>(_trace_count)
+    };
+    out.write(reinterpret_cast<const uint8_t*>(header), sizeof(header));
+    out.write(reinterpret_cast<const uint8_t*>(_trace_buffer), sizeof(_trace_buffer));
+#else
+    (void) out;
+#endif
+}
+
+void JustWifi::traceClear() {
+#if JUSTWIFI_TRACE_SIZE
+    // Nothing stale is left for a copy of the buffer taken from memory
+    std::memset(_trace_buffer, 0, sizeof(_trace_buffer));
+    _trace_head = 0;
+    _trace_count = 0;
+#endif
+}
+
+uint32_t JustWifi::traceCycles() {
+#if JUSTWIFI_TRACE_SIZE
+    return _trace_cycles;
+#else
+    return 0;
+#endif
+}
+
+void JustWifi::setRecorder(recorder_type recorder) {
+    _recorder = recorder;
+}
+
+const justwifi_profile_t* JustWifi::getProfile(justwifi_profile_points_t point) {
+#if JUSTWIFI_ENABLE_PROFILE
+    if (point < PROFILE_MAX) return &_profile[point];
+#else
+    (void) point;
+#endif
+    return nullptr;
+}
+
+void JustWifi::profileDump(Print& out) {
+#if JUSTWIFI_ENABLE_PROFILE
+    static const char* const names[PROFILE_MAX] = {
+        "populate", "sort", "callback", "networks", "idle"
+    };
+
+    for (uint8_t point = 0; point < PROFILE_MAX; ++point) {
+        const auto& profile = _profile[point];
+        char buffer[160];
+        snprintf_P(buffer, sizeof(buffer),
+            PSTR("{\"name\":\"%s\",\"calls\":%u,\"cycles\":%llu,\"max\":%u,\"allocations\":%u,\"networks\":%u,\"results\":%u}\n"),
+            names[point],
+            static_cast<unsigned>(profile.calls),
+            static_cast<unsigned long long>(profile.cycles),
+            static_cast<unsigned>(profile.max),
+            static_cast<unsigned>(profile.allocations),
+            static_cast<unsigned>(_network_list.size()),
+            static_cast<unsigned>(_scan_results)
+        );
+        out.print(buffer);
+    }
+#else
+    (void) out;
+#endif
+}
+
+void JustWifi::profileReset() {
+#if JUSTWIFI_ENABLE_PROFILE
+    for (auto& profile : _profile) {
+        profile = justwifi_profile_t{};
+    }
+#endif
+}
+
+const justwifi_heap_t& JustWifi::getHeap() {
+    return _heap;
+}
+
+void JustWifi::resetHeap() {
+    _heap = justwifi_heap_t{};
+}
+
+unsigned long JustWifi::getLoopMax() {
+    return _loop_max;
+}
+
+void JustWifi::resetLoopMax() {
+    _loop_max = 0;
+}
+
+void JustWifi::setLoopBudget(unsigned long us) {
+    _loop_budget = us;
+}
+
 void JustWifi::loop() {
+    if (!_task_mode) _loop();
+}
+
+bool JustWifi::startTask(uint32_t stack, uint8_t priority) {
+    // Set before the task exists, it may run before taskStart() returns
+    if (_task_mode.exchange(true)) return false;
+    _running = true;
+    if (!backend::taskStart(_task, this, stack, priority)) {
+        _task_mode = false;
+        return false;
+    }
+    return true;
+}
+
+void JustWifi::_task(void* arg) {
+    auto* self = static_cast<JustWifi*>(arg);
+    for (;;) {
+        self->_loop();
+
+        // Nothing to poll while connected and idle, WiFi events will wake us up
+        bool idle = (STATE_IDLE == self->_state) && self->connected();
+        backend::taskWait(idle ? JUSTWIFI_TASK_IDLE_INTERVAL : JUSTWIFI_TASK_INTERVAL);
+    }
+}
+
+void JustWifi::_loop() {
+
+    _loop_start = micros();
+    _running = true;
+
+    // The budget only defers work, every call runs one command and one machine step at least
+    _doCommands();
+    _doStats();
+    _doCycle();
     _machine();
+    _doHeap();
+    _doPower();
+
+    unsigned long elapsed = micros() - _loop_start;
+    if (elapsed > _loop_max) _loop_max = elapsed;
+
 }
 
 JustWifi jw;
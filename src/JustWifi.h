@@ -22,18 +22,102 @@ along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef JustWifi_h
 #define JustWifi_h
 
-#include <ESP8266WiFi.h>
+#include "JustWifiBackend.h"
+#include "JustWifiQueue.h"
 #include <vector>
 
-// Check NO_EXTRA_4K_HEAP build flag in SDK 2.4.2
-#include <core_version.h>
-#if defined(JUSTWIFI_ENABLE_WPS) && defined(ARDUINO_ESP8266_RELEASE_2_4_2) && not defined(NO_EXTRA_4K_HEAP)
-    #error "SDK 2.4.2 has WPS support disabled by default, enable it by adding -DNO_EXTRA_4K_HEAP to your build flags"
-#endif
-
 #define DEFAULT_CONNECT_TIMEOUT         10000
 #define DEFAULT_RECONNECT_INTERVAL      60000
+
+#ifndef JUSTWIFI_SMARTCONFIG_TIMEOUT
 #define JUSTWIFI_SMARTCONFIG_TIMEOUT    60000
+#endif
+
+// Task mode wakes up on every WiFi event, or after this many ms
+#define JUSTWIFI_TASK_INTERVAL          10
+#define JUSTWIFI_TASK_IDLE_INTERVAL     1000
+#define JUSTWIFI_TASK_STACK             4096
+#define JUSTWIFI_TASK_PRIORITY          2
+
+// Pending API calls once loop() is running, must be a power of 2
+#ifndef JUSTWIFI_COMMAND_QUEUE_SIZE
+#define JUSTWIFI_COMMAND_QUEUE_SIZE     16
+#endif
+
+// Number of records kept by the state trace, set to 0 to disable it
+#ifndef JUSTWIFI_TRACE_SIZE
+#define JUSTWIFI_TRACE_SIZE             32
+#endif
+
+// Network ids are uint8_t and 0xFF is none, networks past this are rejected
+#define JUSTWIFI_NETWORKS_MAX           254u
+
+#define JUSTWIFI_TRACE_NO_MESSAGE       0xFFu
+#define JUSTWIFI_TRACE_NO_NETWORK       0xFFu
+
+// SoftAP channel is the least congested one in 1...JUSTWIFI_AP_CHANNEL_MAX, according to the last scan
+#ifndef JUSTWIFI_AP_CHANNEL_MAX
+#define JUSTWIFI_AP_CHANNEL_MAX         11
+#endif
+#define JUSTWIFI_CHANNELS               14
+
+// Sliced scan visits channels 1...JUSTWIFI_SCAN_CHANNEL_MAX, waiting JUSTWIFI_SCAN_GAP ms between slices by default
+#ifndef JUSTWIFI_SCAN_CHANNEL_MAX
+#define JUSTWIFI_SCAN_CHANNEL_MAX       13
+#endif
+#define JUSTWIFI_SCAN_GAP               500
+
+// Candidates are ranked on the RSSI averaged over scans, JUSTWIFI_RSSI_WEIGHT is the weight of
+// the newest sample in %. Missed networks are kept for JUSTWIFI_RSSI_MISSES scans, losing
+// JUSTWIFI_RSSI_MISS_PENALTY dB on each one. See JustWifi::setRSSIFilter()
+#define JUSTWIFI_RSSI_WEIGHT            30
+#define JUSTWIFI_RSSI_MISSES            2
+#define JUSTWIFI_RSSI_MISS_PENALTY      5
+
+// Longest wait for a single warm-up DNS lookup, ms
+#ifndef JUSTWIFI_WARMUP_TIMEOUT
+#define JUSTWIFI_WARMUP_TIMEOUT         2000
+#endif
+
+// Duty cycle gives up after this many ms awake, and does a full RF calibration every this many wakes
+#define JUSTWIFI_CYCLE_TIMEOUT          10000
+#ifndef JUSTWIFI_CYCLE_CALIBRATE
+#define JUSTWIFI_CYCLE_CALIBRATE        16
+#endif
+
+// Radio stays on for this many ms after the duty cycle send hook, so queued packets go out
+#ifndef JUSTWIFI_CYCLE_FLUSH
+#define JUSTWIFI_CYCLE_FLUSH            100
+#endif
+
+// Channel set for JustWifi::setChannelLock(), e.g. JUSTWIFI_CHANNEL(1) | JUSTWIFI_CHANNEL(6)
+#define JUSTWIFI_CHANNEL(CHANNEL)       (1u << ((CHANNEL) - 1))
+
+// Score bonus for candidates on the SoftAP channel, when AP coexistence is enabled
+#define JUSTWIFI_AP_CHANNEL_BONUS       100
+
+// Gateway probe reply timeout (ms) and default number of lost probes before the link is considered dead
+#ifndef JUSTWIFI_HEALTH_TIMEOUT
+#define JUSTWIFI_HEALTH_TIMEOUT         1000
+#endif
+#define JUSTWIFI_HEALTH_MISSES          3
+
+// MESSAGE_DISCONNECTED reason when the health check dropped the link, outside of the SDK codes
+#define JUSTWIFI_REASON_UNREACHABLE     0xFFu
+
+// TX power range used by power policies, dBm
+#define JUSTWIFI_TX_POWER_MAX           20
+#define JUSTWIFI_TX_POWER_MIN           8
+
+// TX power follows the signal, re-evaluated every this many ms
+#define JUSTWIFI_POWER_INTERVAL         10000
+
+// Radio-on time estimate, the radio wakes up for ~JUSTWIFI_POWER_WAKE_MS every beacon it listens to
+#define JUSTWIFI_POWER_WAKE_MS          5
+#define JUSTWIFI_BEACON_INTERVAL        102
+
+// SDK disconnect reasons are 1...24 and 200...204, see JustWifi::reasonIndex()
+#define JUSTWIFI_DISCONNECT_REASONS     30
 
 #ifdef DEBUG_ESP_WIFI
 #ifdef DEBUG_ESP_PORT
@@ -45,6 +129,76 @@ along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
 #define DEBUG_WIFI_MULTI(...)
 #endif
 
+typedef enum {
+    SLEEP_DEFAULT,
+    SLEEP_NONE,
+    SLEEP_LIGHT,
+    SLEEP_MODEM
+} justwifi_sleep_t;
+
+typedef enum {
+    PHY_DEFAULT,
+    PHY_11B,
+    PHY_11G,
+    PHY_11N
+} justwifi_phy_t;
+
+// Station power settings, see JustWifi::setPowerPolicy(). Zero-initialized policy leaves SDK defaults alone
+typedef struct {
+    uint8_t sleep;              // justwifi_sleep_t
+    uint8_t listen_interval;    // beacons between wakeups while sleeping, 0 is every DTIM
+    uint8_t phy;                // justwifi_phy_t
+    int8_t rssi_target;         // dBm, TX power is lowered by the signal margin above it. 0 keeps full power
+} justwifi_power_t;
+
+typedef struct {
+    uint32_t total;             // ms since begin() or the last reset
+    uint32_t radio_on;          // ms, estimated from the sleep mode and listen interval
+    uint8_t tx_power;           // dBm, last one set by the policy
+} justwifi_power_stats_t;
+
+// One wake of JustWifi::startCycle(), kept in RTC memory through deep sleep
+typedef struct {
+    uint32_t awake;             // ms from boot to deep sleep
+    uint32_t ready;             // ms from boot to connected (and warmed up), 0 when it failed
+    bool fast;                  // connected using the channel and BSSID stored by the previous wake
+    bool sent;                  // send hook was called
+} justwifi_cycle_t;
+
+// Time spent off-channel by sliced scans, see JustWifi::setScanSlices()
+typedef struct {
+    uint32_t slices;            // since begin() or the last reset
+    uint32_t sweeps;            // every channel visited
+    uint32_t last;              // ms, last slice
+    uint32_t max;               // ms, longest slice
+    uint32_t total;             // ms
+} justwifi_scan_stats_t;
+
+typedef struct {
+    uint16_t attempts { 0u };
+    uint16_t successes { 0u };
+    uint16_t disconnects { 0u };    // established sessions that dropped
+    // Every reason reported by the SDK, failed attempts included
+    uint16_t reasons[JUSTWIFI_DISCONNECT_REASONS] { 0u };
+    uint8_t last_reason { 0u };
+    uint8_t history { 0u };         // outcome of the recent attempts, bit 0 is the latest (1 is success)
+    uint8_t history_size { 0u };    // number of valid bits in history, up to 8
+    uint32_t uptime { 0u };         // ms, sum of all finished sessions
+    uint32_t longest { 0u };        // ms, longest finished session
+    uint16_t joins { 0u };          // successful attempts we timed, SDK reconnects and adopted links are not
+    uint32_t join_time { 0u };      // ms, sum of the timed ones
+    uint16_t probes { 0u };         // gateway probes sent, see JustWifi::setHealthCheck()
+    uint16_t lost { 0u };           // probes without a reply
+    uint16_t unreachable { 0u };    // times the gateway was declared unreachable and we moved on
+    uint16_t rtt { 0u };            // ms, last probe round trip
+    uint16_t rtt_max { 0u };        // ms, longest probe round trip
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    uint16_t kept { 0u };           // successful attempts with the credentials left configured by the previous one,
+                                    // only setting them is skipped, the SDK still runs the whole EAP exchange
+    uint32_t kept_time { 0u };      // ms, part of join_time spent in those
+#endif
+} network_stats_t;
+
 typedef struct {
     char * ssid { nullptr };
     char * pass { nullptr };
@@ -54,17 +208,39 @@ typedef struct {
     IPAddress gw;
     IPAddress netmask;
     IPAddress dns;
-    int32_t rssi { 0 };
+    int32_t rssi { 0 };             // dBm, averaged over scans. 0 when not a candidate
+    int32_t rssi_last { 0 };        // dBm, best sample of the last scan
+    int16_t rssi_filter { 0 };      // 1/16 dBm
+    uint8_t missed { 0u };          // scans in a row without it
+    int32_t score { 0 };
     uint8_t security { 0u };
     uint8_t channel { 0u };
     uint8_t bssid[6] { 0u };
     uint8_t next { 0xFFu };
+    network_stats_t stats;
+    justwifi_power_t power {};
+    bool power_set { false };
+    bool applied { false };         // seen by the current JustWifi::applyNetworks()
 #if JUSTWIFI_ENABLE_ENTERPRISE
     char * enterprise_username { nullptr };
     char * enterprise_password { nullptr };
 #endif
 } network_t;
 
+// Settings of a single network for JustWifi::applyNetworks(), same as the addNetwork() arguments
+typedef struct {
+    const char * ssid;
+    const char * pass;
+    const char * ip;
+    const char * gw;
+    const char * netmask;
+    const char * dns;
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    const char * enterprise_username;
+    const char * enterprise_password;
+#endif
+} justwifi_network_config_t;
+
 typedef enum {
     STATE_IDLE,
     STATE_SCAN_START,
@@ -81,7 +257,10 @@ typedef enum {
     STATE_SMARTCONFIG_ONGOING,
     STATE_SMARTCONFIG_FAILED,
     STATE_SMARTCONFIG_SUCCESS,
-    STATE_FALLBACK
+    STATE_FALLBACK,
+    STATE_TURNING_OFF,
+    STATE_TURNING_ON,
+    STATE_WARMUP
 } justwifi_states_t;
 
 typedef enum {
@@ -107,9 +286,95 @@ typedef enum {
     MESSAGE_WPS_ERROR,
     MESSAGE_SMARTCONFIG_START,
     MESSAGE_SMARTCONFIG_SUCCESS,
-    MESSAGE_SMARTCONFIG_ERROR
+    MESSAGE_SMARTCONFIG_ERROR,
+    MESSAGE_ACCESSPOINT_CHANNEL_CHANGE,
+    MESSAGE_COMMAND_DONE,
+    MESSAGE_GATEWAY_UNREACHABLE,
+    MESSAGE_NETWORK_READY,
+    MESSAGE_CYCLE_SLEEP,
+    MESSAGE_CHANNEL_CHANGE
 } justwifi_messages_t;
 
+typedef enum {
+    COMMAND_ADD_NETWORK,
+    COMMAND_CLEAN_NETWORKS,
+    COMMAND_ENABLE_STA,
+    COMMAND_ENABLE_AP,
+    COMMAND_DISCONNECT,
+    COMMAND_TURN_OFF,
+    COMMAND_TURN_ON,
+    COMMAND_START_WPS,
+    COMMAND_START_SMARTCONFIG,
+    COMMAND_SET_POWER,
+    COMMAND_UPDATE_NETWORK,
+    COMMAND_REMOVE_NETWORK,
+    COMMAND_APPLY_NETWORKS,
+    COMMAND_START_CYCLE,
+    COMMAND_LOCK_CHANNELS,
+    COMMAND_SET_SOFTAP,
+    COMMAND_HEALTH_CHECK,
+    COMMAND_SUBSCRIBE
+} justwifi_commands_t;
+
+// Compact trace record. Kept POD so the ring buffer can be copied verbatim
+// and decoded elsewhere (all fields are little-endian on ESP), see JustWifi::traceDumpRaw().
+typedef struct {
+    uint32_t timestamp;     // millis() when recorded
+    uint8_t state;          // justwifi_states_t before the record
+    uint8_t next_state;     // justwifi_states_t after the record
+    uint8_t message;        // justwifi_messages_t or JUSTWIFI_TRACE_NO_MESSAGE
+    uint8_t network;        // index in the network list or JUSTWIFI_TRACE_NO_NETWORK
+    int8_t rssi;            // dBm, 0 when unknown
+    uint8_t status;         // wl_status_t or scan result count, depending on the message
+} justwifi_trace_t;
+
+typedef enum {
+    INPUT_SCAN,             // scan finished, 'value' is the result count (int8_t, negative on failure)
+    INPUT_SCAN_RESULT,      // one per result of the last INPUT_SCAN
+    INPUT_CONNECT,          // connection attempt, 'value' is the status right after it
+    INPUT_STATUS,           // status change of the last INPUT_CONNECT, 'value' is wl_status_t
+    INPUT_RESOLVE,          // warm-up lookup of the host in 'ssid' (truncated), 'value' is 1 when resolved
+    INPUT_PROBE,            // gateway probe, 'value' is 1 when answered, 'time' is the round trip or the timeout
+    INPUT_PROVISION         // WPS / SmartConfig result in 'ssid', with 'channel' and 'bssid' when known (0 otherwise)
+} justwifi_input_types_t;
+
+// Radio input as seen by the state machine, see JustWifi::setRecorder() and JustWifiReplay.h.
+// POD with a fixed size, so a capture is simply an array of these
+typedef struct {
+    uint32_t time;          // ms since the scan or the connection attempt started
+    uint8_t type;           // justwifi_input_types_t
+    uint8_t value;
+    int8_t rssi;
+    uint8_t channel;
+    uint8_t security;
+    uint8_t bssid[6];
+    char ssid[33];
+} justwifi_input_t;
+
+// Hot paths measured when built with -DJUSTWIFI_ENABLE_PROFILE
+typedef enum {
+    PROFILE_POPULATE,
+    PROFILE_SORT,
+    PROFILE_CALLBACK,
+    PROFILE_NETWORKS,
+    PROFILE_IDLE,
+    PROFILE_MAX
+} justwifi_profile_points_t;
+
+typedef struct {
+    uint32_t calls;
+    uint64_t cycles;        // sum of all calls, CPU cycles (80 MHz equivalent on the host)
+    uint32_t max;           // longest call
+    uint32_t allocations;   // heap allocations during the calls, 0 when the backend doesn't count them
+} justwifi_profile_t;
+
+// Free heap samples taken by loop(), in bytes. 0 until the state was seen
+typedef struct {
+    uint32_t idle;          // last sample while connected and idle
+    uint32_t scan;          // lowest sample while scanning
+    uint32_t connect;       // lowest sample while connecting
+} justwifi_heap_t;
+
 enum {
     RESPONSE_START,
     RESPONSE_OK,
@@ -117,6 +382,87 @@ enum {
     RESPONSE_FAIL
 };
 
+namespace justwifi {
+
+// Read-only access to a network_t in place, without the password.
+// Valid until the next change of the networks list, i.e. until the next JustWifi::loop() call.
+// After JustWifi::startTask() the list changes in that task at any time and nothing is locked,
+// so views (and getStats()) can only be used from the message callbacks, which run in the task.
+// Copy what is needed there when other tasks need it
+class NetworkView {
+
+    public:
+
+        NetworkView() = default;
+        NetworkView(const network_t* network, uint8_t id) :
+            _network(network),
+            _id(id)
+        {}
+
+        explicit operator bool() const { return _network != nullptr; }
+
+        uint8_t id() const { return _id; }
+        const char* ssid() const { return _network->ssid; }
+        bool secured() const { return _network->pass != nullptr; }
+#if JUSTWIFI_ENABLE_ENTERPRISE
+        bool enterprise() const { return _network->enterprise_username != nullptr; }
+#endif
+        bool dhcp() const { return _network->dhcp; }
+        const IPAddress& ip() const { return _network->ip; }
+
+        // From the last scan, RSSI is averaged over the previous ones too
+        bool scanned() const { return _network->scanned; }
+        int32_t rssi() const { return _network->rssi; }
+        int32_t lastRSSI() const { return _network->rssi_last; }
+        uint8_t missed() const { return _network->missed; }
+        int32_t score() const { return _network->score; }
+        uint8_t security() const { return _network->security; }
+        uint8_t channel() const { return _network->channel; }
+        const uint8_t* bssid() const { return _network->bssid; }
+
+        const network_stats_t& stats() const { return _network->stats; }
+
+    private:
+
+        const network_t* _network { nullptr };
+        uint8_t _id { 0xFF };
+
+};
+
+// Range over the networks list in the order they were added, for (auto network : jw.networks()) { ... }
+class NetworkRange {
+
+    public:
+
+        class Iterator {
+            public:
+                Iterator(const network_t* data, uint8_t id) : _data(data), _id(id) {}
+                NetworkView operator*() const { return NetworkView(_data + _id, _id); }
+                Iterator& operator++() { ++_id; return *this; }
+                bool operator!=(const Iterator& other) const { return _id != other._id; }
+            private:
+                const network_t* _data;
+                uint8_t _id;
+        };
+
+        NetworkRange(const network_t* data, uint8_t size) :
+            _data(data),
+            _size(size)
+        {}
+
+        Iterator begin() const { return Iterator(_data, 0); }
+        Iterator end() const { return Iterator(_data, _size); }
+        uint8_t size() const { return _size; }
+
+    private:
+
+        const network_t* _data;
+        uint8_t _size;
+
+};
+
+} // namespace justwifi
+
 class JustWifi {
 
     public:
@@ -129,10 +475,29 @@ class JustWifi {
 
         using networks_type = std::vector<network_t>;
 
+        using trace_callback_type = void(*)(const justwifi_trace_t&);
+        using recorder_type = void(*)(const justwifi_input_t&);
+        using send_type = void(*)();
+
+        // Higher score is tried first. 'sticky' is set for the network we were connected to the last time
+        using score_type = int32_t(*)(const network_t& network, bool sticky);
+
         JustWifi();
         ~JustWifi();
 
-        void cleanNetworks();
+        // Methods changing the networks list or the radio state are queued and executed by loop()
+        // in the order they were called, so they are safe to call from callbacks and other tasks.
+        // MESSAGE_COMMAND_DONE is sent after every one of them, false is returned when the queue is full
+        // (JUSTWIFI_COMMAND_QUEUE_SIZE calls between two loop() runs). Until the first loop() or startTask()
+        // they are executed right away instead, so setup() can add any number of networks.
+        //
+        // Settings methods that are not queued write the settings directly: setConnectTimeout(),
+        // setReconnectTimeout(), setSmartConfigTimeout(), setHostname(), setScoring(), setScanSlices(),
+        // setRSSIFilter(), global setPowerPolicy(), setWarmup(), enableWarmup(), enableScan(), enableAPFallback(),
+        // enableAPCoexistence(), setLoopBudget(), setRecorder(), setEnterpriseCACert() and the reset*() ones.
+        // Call them before startTask(). After it they are only safe from the message callbacks, which run in the task
+
+        bool cleanNetworks();
         bool addCurrentNetwork();
         bool addNetwork(
             const char * ssid,
@@ -143,7 +508,30 @@ class JustWifi {
             const char * dns = nullptr
         );
 
+        // Changes keyed by SSID. Scan data, stats and power policy of the network are kept.
+        // When the network is in use and its settings change, it is dropped and connected again.
+        // updateNetwork() adds the network when it is not in the list yet
+        bool updateNetwork(
+            const char * ssid,
+            const char * pass = nullptr,
+            const char * ip = nullptr,
+            const char * gw = nullptr,
+            const char * netmask = nullptr,
+            const char * dns = nullptr
+        );
+        bool removeNetwork(const char * ssid);
+
+        // Makes the list match 'networks', updating, adding and removing entries as needed.
+        // Settings are copied into a single allocation and applied by one queued command, all or nothing.
+        // Unchanged networks keep their strings, changed ones reuse them when the new value fits.
+        // The list holds JUSTWIFI_NETWORKS_MAX networks, addNetwork() past it is dropped and a bigger set is rejected
+        bool applyNetworks(const justwifi_network_config_t * networks, size_t count);
+
 #if JUSTWIFI_ENABLE_ENTERPRISE
+        // CA certificate (PEM) the server is checked against, for all enterprise networks.
+        // Not copied, must stay valid. nullptr disables the check
+        void setEnterpriseCACert(const char * pem);
+
         bool addEnterpriseNetwork(
             const char * ssid,
             const char * enterprise_username = nullptr,
@@ -164,9 +552,14 @@ class JustWifi {
 
         void setHostname(const char * hostname);
         void setConnectTimeout(unsigned long ms);
+        void setSmartConfigTimeout(unsigned long ms = JUSTWIFI_SMARTCONFIG_TIMEOUT);
         void setReconnectTimeout(unsigned long ms = DEFAULT_RECONNECT_INTERVAL);
         void resetReconnectTimeout();
-        void subscribe(callback_type callback);
+        bool subscribe(callback_type callback);
+
+        // Set candidate ordering policy, nullptr restores defaultScore()
+        void setScoring(score_type scoring);
+        static int32_t defaultScore(const network_t& network, bool sticky);
 
         wl_status_t getStatus();
         String getAPSSID();
@@ -174,36 +567,191 @@ class JustWifi {
         bool connected();
         bool connectable();
 
-        void turnOff();
-        void turnOn();
-        void disconnect();
+        // Time in ms from startWPS() / startSmartConfig() to having an IP, 0 when not provisioned yet
+        unsigned long getProvisioningTime();
+
+        // Warm the network up right after connecting: announce ourselves and the gateway over ARP,
+        // restart SNTP with 'ntp' and look up 'hosts' one by one, then send MESSAGE_NETWORK_READY.
+        // Names are not copied. getReadyTime() is the time in ms from MESSAGE_CONNECTED to ready
+        void enableWarmup(bool enabled);
+        void setWarmup(const char * const * hosts, size_t count, const char * ntp = nullptr);
+        unsigned long getReadyTime();
+
+        // Battery nodes: connect on the shortest path (channel and BSSID stored by the previous wake
+        // when it worked), call 'send' once, then shut the radio down and deep sleep for 'sleep_us'.
+        // Radio is kept on for JUSTWIFI_CYCLE_FLUSH ms after 'send', loop() keeps running meanwhile.
+        // Sleeps anyway 'timeout' ms after the cycle started. MESSAGE_CYCLE_SLEEP is sent right before sleeping,
+        // getLastCycle() reports the previous wake after boot (queued, call after adding networks)
+        bool startCycle(send_type send, uint64_t sleep_us, unsigned long timeout = JUSTWIFI_CYCLE_TIMEOUT);
+        const justwifi_cycle_t& getLastCycle();
+
+        // Probe the gateway every 'interval' ms while connected (0 disables it). After 'misses' lost
+        // probes in a row MESSAGE_GATEWAY_UNREACHABLE is sent and the next candidate is tried.
+        // MESSAGE_DISCONNECTED follows with JUSTWIFI_REASON_UNREACHABLE as the reason
+        bool setHealthCheck(unsigned long interval, uint8_t misses = JUSTWIFI_HEALTH_MISSES);
+
+        // Power settings applied to the station link. PHY mode is set before connecting,
+        // sleep mode and TX power after MESSAGE_CONNECTED. Per-network policy (queued) overrides the global one
+        void setPowerPolicy(const justwifi_power_t& policy);
+        bool setPowerPolicy(const char * ssid, const justwifi_power_t& policy);
+        const justwifi_power_stats_t& getPowerStats();
+        void resetPowerStats();
+
+        // Networks list, read in place. See justwifi::NetworkView for how long it stays valid,
+        // and where it can be used from in task mode
+        justwifi::NetworkRange networks() const;
+        justwifi::NetworkView getNetwork(uint8_t id) const;
+
+        // Network we are connected to, or the one currently being tried. Empty view when there is none
+        justwifi::NetworkView getActiveNetwork() const;
+        justwifi::NetworkView getCandidateNetwork() const;
+
+        // Reliability counters of the network at the given index (in the order of addNetwork calls)
+        const network_stats_t* getStats(uint8_t id);
+
+        // Maps SDK disconnect reason to the network_stats_t::reasons index and back
+        static uint8_t reasonIndex(uint8_t reason);
+        static uint8_t reasonFromIndex(uint8_t index);
+
+        bool turnOff();
+        bool turnOn();
+        bool disconnect();
         void enableScan(bool scan);
-        void enableSTA(bool enabled);
-        void enableAP(bool enabled);
+
+        // Scan 'channels' channels per step instead of sweeping all of them at once, spending up to
+        // 'dwell' ms on each (ESP32 only, 0 keeps the SDK default) and waiting 'gap' ms between steps.
+        // Results accumulate until every channel was visited. With 'background', slices keep running
+        // while connected to refresh the candidates. 0 channels restores the full sweep, and so do backends
+        // that can't scan a single channel (ESP32 Arduino core 1.x)
+        void setScanSlices(uint8_t channels, uint32_t dwell = 0, uint32_t gap = JUSTWIFI_SCAN_GAP, bool background = false);
+        const justwifi_scan_stats_t& getScanStats();
+        void resetScanStats();
+
+        // Weight of the newest scan sample in the RSSI average (%, 100 ranks on the last scan only)
+        // and how many scans in a row a network can be missed before it stops being a candidate
+        void setRSSIFilter(uint8_t weight, uint8_t misses = JUSTWIFI_RSSI_MISSES);
+        bool enableSTA(bool enabled);
+        bool enableAP(bool enabled);
         void enableAPFallback(bool enabled);
 
+        // Keep the radio on the given channels (JUSTWIFI_CHANNEL() bits, 0 unlocks), e.g. for ESP-NOW peers.
+        // Only those are scanned and joined, which implies scanning, and SoftAP is created on one of them.
+        // Backends that can't scan a single channel (ESP32 Arduino core 1.x) still sweep all of them.
+        // MESSAGE_CHANNEL_CHANGE is sent before the radio moves to another channel of the set, or off
+        // a channel that is no longer in it (queued)
+        bool setChannelLock(uint16_t channels);
+
+        // Keep the SoftAP running while STA scans and connects. Networks on the AP channel are
+        // preferred, other ones are deferred while AP has clients and MESSAGE_ACCESSPOINT_CHANNEL_CHANGE
+        // is sent before the channel moves.
+        void enableAPCoexistence(bool enabled);
+
         #if defined(JUSTWIFI_ENABLE_WPS)
-            void startWPS();
+            bool startWPS();
         #endif
 
         #if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
-            void startSmartConfig();
+            bool startSmartConfig();
         #endif
 
+        // Records are passed from the oldest to the newest. tools/trace_decode.py decodes traceDump() output,
+        // and traceDumpRaw() output with --binary: head and count (uint32_t each) followed by the ring buffer as is
+        size_t traceCount();
+        void traceEach(trace_callback_type callback);
+        void traceDump(Print& out);
+        void traceDumpRaw(Print& out);
+        void traceClear();
+
+        // Maximum CPU cycles spent writing a single record
+        uint32_t traceCycles();
+
+        // Every scan result and connection status change is passed to the recorder,
+        // so it can be stored and replayed later. nullptr disables recording
+        void setRecorder(recorder_type recorder);
+
+        // Profiling counters, nullptr when built without JUSTWIFI_ENABLE_PROFILE.
+        // Dump prints one JSON object per line, so it can be collected and compared between builds.
+        // 'networks' and 'results' are the current list size and the last scan result count
+        const justwifi_profile_t* getProfile(justwifi_profile_points_t point);
+        void profileDump(Print& out);
+        void profileReset();
+
+        // Heap usage is 'idle' minus 'scan' or 'connect'. See examples/footprint
+        const justwifi_heap_t& getHeap();
+        void resetHeap();
+
+        // Longest loop() call in microseconds, since boot or the last reset
+        unsigned long getLoopMax();
+        void resetLoopMax();
+
+        // When loop() runs longer than the budget (in microseconds), the remaining work
+        // (e.g. processing scan results) is deferred to the next call. 0 means no limit. Every call
+        // still runs one command, one state machine step and processes one scan result
+        void setLoopBudget(unsigned long us);
+
         void begin();
         void loop();
 
+        // Run loop() in a dedicated task (ESP32 only, pinned to the WiFi core). Application loop()
+        // calls are ignored afterwards. Returns false when not supported by the backend.
+        // Networks list and its stats are only safe to read from the message callbacks then
+        bool startTask(uint32_t stack = JUSTWIFI_TASK_STACK, uint8_t priority = JUSTWIFI_TASK_PRIORITY);
+
     private:
 
+        // updateNetwork() / applyNetworks() settings, strings are stored right after the array
+        typedef struct {
+            size_t count;
+            justwifi_network_config_t * networks;
+        } network_set_t;
+
+        typedef struct {
+            justwifi_commands_t type;
+            bool enabled;
+            network_t * network;
+            network_set_t * set;
+            // setHealthCheck(), setChannelLock(), startCycle() and subscribe() arguments
+            unsigned long value;
+            uint8_t misses;
+            uint64_t sleep;
+            send_type send;
+            callback_type callback;
+        } command_t;
+
+        justwifi::Queue<command_t, JUSTWIFI_COMMAND_QUEUE_SIZE> _commands;
+        std::atomic<bool> _running { false };
+
         networks_type _network_list;
         callbacks_type _callbacks;
 
         unsigned long _connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+        unsigned long _smartconfig_timeout = JUSTWIFI_SMARTCONFIG_TIMEOUT;
+        unsigned long _provision_start = 0;
+        unsigned long _provision_time = 0;
+        bool _provisioning = false;
         unsigned long _reconnect_timeout = DEFAULT_RECONNECT_INTERVAL;
         unsigned long _timeout = 0;
         unsigned long _start = 0;
+        unsigned long _loop_start = 0;
+        unsigned long _loop_max = 0;
+        unsigned long _loop_budget = 0;
+        justwifi_heap_t _heap {};
+        recorder_type _recorder = nullptr;
+
+        // Congestion seen by the last scan, index is channel - 1
+        uint8_t _channel_networks[JUSTWIFI_CHANNELS] { 0u };
+        uint16_t _channel_load[JUSTWIFI_CHANNELS] { 0u };
+        bool _channel_scanned = false;
         uint8_t _currentID;
         bool _scan = false;
+        uint16_t _channel_lock = 0;
+        uint8_t _slice_channels = 0;
+        uint32_t _slice_dwell = 0;
+        uint32_t _slice_gap = JUSTWIFI_SCAN_GAP;
+        bool _slice_background = false;
+        justwifi_scan_stats_t _scan_stats {};
+        uint8_t _rssi_weight = JUSTWIFI_RSSI_WEIGHT;
+        uint8_t _rssi_misses = JUSTWIFI_RSSI_MISSES;
         char _hostname[33];
         network_t _softap;
 
@@ -215,18 +763,147 @@ class JustWifi {
 
         bool _ap_connected = false;
         bool _ap_fallback_enabled = true;
+        bool _ap_coexistence = false;
+
+        volatile uint8_t _disconnected_reason = 0;
+        std::atomic<bool> _task_mode { false };
+        uint8_t _stats_id = 0xFF;
+        uint8_t _last_id = 0xFF;
+        score_type _scoring = defaultScore;
+        bool _sta_session = false;
+        unsigned long _sta_session_start = 0;
+
+        bool _warmup = false;
+        const char * const * _warmup_hosts = nullptr;
+        size_t _warmup_count = 0;
+        const char * _warmup_ntp = nullptr;
+        unsigned long _ready_time = 0;
+
+        bool _cycle = false;
+        bool _cycle_fast = false;
+        send_type _cycle_send = nullptr;
+        uint64_t _cycle_sleep = 0;
+        unsigned long _cycle_timeout = JUSTWIFI_CYCLE_TIMEOUT;
+        unsigned long _cycle_start = 0;
+        justwifi_cycle_t _cycle_last {};
+        justwifi_cycle_t _cycle_current {};
+        unsigned long _cycle_flush = 0;
+
+        unsigned long _health_interval = 0;
+        uint8_t _health_misses = JUSTWIFI_HEALTH_MISSES;
+        justwifi_power_t _power_policy {};
+        justwifi_power_stats_t _power_stats {};
+        uint16_t _power_duty = 1000;
+        uint32_t _power_remainder = 0;
+        unsigned long _power_tick = 0;
+        unsigned long _power_check = 0;
+
+        uint8_t _health_lost = 0;
+        bool _health_pending = false;
+        unsigned long _health_start = 0;
+
+#if JUSTWIFI_ENABLE_PROFILE
+        justwifi_profile_t _profile[PROFILE_MAX] {};
+        uint8_t _scan_results = 0;   // last scan (or channel slice) result count, for profileDump()
+#endif
+
+#if JUSTWIFI_TRACE_SIZE
+        justwifi_trace_t _trace_buffer[JUSTWIFI_TRACE_SIZE];
+        size_t _trace_head = 0;
+        size_t _trace_count = 0;
+        uint32_t _trace_cycles = 0;
+        justwifi_states_t _trace_state = STATE_IDLE;
+#endif
 
         bool _doAP();
         uint8_t _doScan();
+        uint8_t _doScanSlice(bool reset = false);
+        void _doBackgroundScan();
         uint8_t _doSTA(uint8_t id = 0xFF);
-
-        void _disable();
+        uint8_t _doWarmup(bool reset = false);
+
+        bool _overBudget();
+        bool _apCoexists();
+        bool _apChannelAllowed(uint8_t id);
+        uint8_t _apChannel(uint16_t& load);
+        bool _useScan();
+        bool _channelAllowed(uint8_t channel);
+        bool _lockAllows(uint8_t id);
+        uint8_t _nextChannel(uint8_t channel);
+        void _channelChange(uint8_t from, uint8_t to, uint8_t id);
+        void _lockChannels(uint16_t channels);
+        void _countChannel(int32_t channel, int32_t rssi);
         void _machine();
-        uint8_t _populate(uint8_t networkCount);
-        uint8_t _sortByRSSI();
+        void _machineStep();
+        bool _post(justwifi_commands_t type, bool enabled = false, network_t * network = nullptr, network_set_t * set = nullptr);
+        bool _post(command_t& command);
+        void _doCommand(command_t& command);
+        void _freeCommand(command_t& command);
+        void _doCommands();
+        void _cleanNetworks();
+        network_t * _makeNetwork(
+            const char * ssid,
+            const char * pass = nullptr,
+            const char * ip = nullptr,
+            const char * gw = nullptr,
+            const char * netmask = nullptr,
+            const char * dns = nullptr
+        );
+        network_t * _makeNetwork(const justwifi_network_config_t& config);
+        bool _addNetwork(network_t * network);
+        uint8_t _findNetwork(const char * ssid);
+        bool _networkBusy(uint8_t id);
+        void _dropNetwork(uint8_t id);
+        network_set_t * _makeNetworkSet(const justwifi_network_config_t * networks, size_t count);
+        void _updateNetworks(network_set_t * set, bool replace);
+        void _updateNetwork(const justwifi_network_config_t& config);
+        void _removeNetwork(network_t * network);
+        void _removeNetwork(uint8_t id);
+        void _enableAP(bool enabled);
+        void _setSoftAP(network_t * network);
+        void _setHealthCheck(unsigned long interval, uint8_t misses);
+        void _disconnect();
+        void _turnOff();
+        void _turnOn();
+        void _loop();
+        static void _task(void* arg);
+        static void _onEvent(void* arg, justwifi::backend::Event event, uint8_t reason);
+        justwifi_states_t _nextCandidate();
+        void _doStats();
+        void _doHeap();
+        void _doPower();
+        const justwifi_power_t& _powerPolicy(uint8_t id);
+        void _preparePower(uint8_t id);
+        void _applyPower(uint8_t id);
+        void _applyTxPower(const justwifi_power_t& policy);
+        void _setPower(network_t * network);
+        void _doHealth();
+        void _startCycle();
+        void _doCycle();
+        void _cycleSleep(bool connected);
+        void _unreachable();
+        void _startSession();
+        void _onConnected(uint8_t id, unsigned long join_time, bool timed = true);
+        void _provisioned();
+        void _recordAttempt(network_t& entry, bool success);
+        void _finishSession();
+        bool _populate(uint8_t networkCount, uint8_t& index, uint8_t& count, uint8_t channel = 0);
+        uint8_t _filterRSSI();
+        uint8_t _sortByScore();
         String _MAC2String(const unsigned char* mac);
         String _encodingString(uint8_t security);
         void _doCallback(justwifi_messages_t message, char * parameter = nullptr);
+        void _record(
+            justwifi_input_types_t type,
+            uint8_t value,
+            uint32_t time,
+            const char * ssid = nullptr,
+            int32_t rssi = 0,
+            uint8_t security = 0,
+            uint8_t channel = 0,
+            const uint8_t * bssid = nullptr
+        );
+        void _trace(uint8_t message, uint8_t network = JUSTWIFI_TRACE_NO_NETWORK, int32_t rssi = 0, uint8_t status = 0);
 
 };
 
@@ -0,0 +1,261 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef JustWifiBackend_h
+#define JustWifiBackend_h
+
+// Everything JustWifi needs from the radio goes through these functions.
+// ESP8266 and ESP32 implementations are provided, build with -DJUSTWIFI_BACKEND_CUSTOM
+// to disable both and link your own (e.g. host-side stub for testing), or with
+// -DJUSTWIFI_BACKEND_REPLAY to feed recorded inputs back (see JustWifiReplay.h)
+
+#if (defined(JUSTWIFI_BACKEND_CUSTOM) || defined(JUSTWIFI_BACKEND_REPLAY)) \
+    && !defined(ARDUINO_ARCH_ESP8266) && !defined(ARDUINO_ARCH_ESP32)
+
+// Host build. Arduino.h only has to provide String, IPAddress, Print, millis() and micros(),
+// see tests/host for a minimal one. Radio types are the ESP8266 ones
+#include <Arduino.h>
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+typedef enum {
+    WL_IDLE_STATUS      = 0,
+    WL_NO_SSID_AVAIL    = 1,
+    WL_SCAN_COMPLETED   = 2,
+    WL_CONNECTED        = 3,
+    WL_CONNECT_FAILED   = 4,
+    WL_CONNECTION_LOST  = 5,
+    WL_DISCONNECTED     = 6
+} wl_status_t;
+
+typedef enum {
+    WIFI_OFF    = 0,
+    WIFI_STA    = 1,
+    WIFI_AP     = 2,
+    WIFI_AP_STA = 3
+} WiFiMode_t;
+
+#define WIFI_SCAN_RUNNING   (-1)
+#define WIFI_SCAN_FAILED    (-2)
+
+#define ENC_TYPE_TKIP   2
+#define ENC_TYPE_CCMP   4
+#define ENC_TYPE_WEP    5
+#define ENC_TYPE_NONE   7
+#define ENC_TYPE_AUTO   8
+
+#elif defined(ARDUINO_ARCH_ESP32)
+
+#include <WiFi.h>
+
+#if defined(JUSTWIFI_ENABLE_WPS)
+    #error "WPS is not supported on ESP32"
+#endif
+
+// Scan results are reported using ESP8266 encryption types
+#ifndef ENC_TYPE_NONE
+#define ENC_TYPE_TKIP   2
+#define ENC_TYPE_CCMP   4
+#define ENC_TYPE_WEP    5
+#define ENC_TYPE_NONE   7
+#define ENC_TYPE_AUTO   8
+#endif
+
+#else
+
+#include <ESP8266WiFi.h>
+
+// Single channel scans, sleep listen interval, lwIP2 raw pcbs and SNTP need Core 2.5.0+
+#include <core_version.h>
+#if defined(ARDUINO_ESP8266_RELEASE_2_3_0) || defined(ARDUINO_ESP8266_RELEASE_2_4_0) \
+    || defined(ARDUINO_ESP8266_RELEASE_2_4_1) || defined(ARDUINO_ESP8266_RELEASE_2_4_2)
+    #error "JustWifi requires Arduino Core for ESP8266 2.5.0 or newer"
+#endif
+
+#endif
+
+// RTC memory used by the backend. ESP8266 keeps it in the user part at the given block (4 bytes each)
+#ifndef JUSTWIFI_RTC_OFFSET
+#define JUSTWIFI_RTC_OFFSET             64
+#endif
+#define JUSTWIFI_RTC_SIZE               64
+
+namespace justwifi {
+namespace backend {
+
+enum class Event : uint8_t {
+    StationConnected,
+    StationDisconnected,
+    StationGotIP,
+    Other
+};
+
+// Handler is called from the SDK (ESP8266) or the event task (ESP32) context
+using event_handler_type = void(*)(void* arg, Event event, uint8_t reason);
+
+// Credentials the station is configured with. Channel is 0 when the AP channel is not known, BSSID is unused then
+struct StationConfig {
+    char ssid[33];
+    char pass[65];
+    uint8_t bssid[6];
+    uint8_t channel;
+};
+
+enum class Sleep : uint8_t {
+    None,
+    Light,
+    Modem
+};
+
+enum class Phy : uint8_t {
+    B,
+    G,
+    N
+};
+
+enum class Resolve : uint8_t {
+    Running,
+    Success,
+    Failed
+};
+
+enum class Wps : uint8_t {
+    Running,
+    Success,
+    Failed
+};
+
+// System
+
+uint32_t chipId();
+uint32_t cycles();
+uint32_t freeHeap();
+// Heap allocations made so far, 0 when they are not counted (the SDK heaps don't)
+uint32_t allocations();
+
+// Deep sleep, never returns on the device. RTC memory survives it. 'calibrate' runs the full
+// RF calibration on the next wake, otherwise the stored calibration data is used (ESP8266 only)
+
+bool rtcRead(void* data, size_t size);
+bool rtcWrite(const void* data, size_t size);
+void deepSleep(uint64_t us, bool calibrate);
+
+// Radio
+
+void persistent(bool enabled);
+uint8_t mode();
+bool enableSTA(bool enabled);
+bool enableAP(bool enabled);
+void off();
+bool sleep();
+bool wake();
+void setEventHandler(event_handler_type handler, void* arg);
+
+// Power save. Listen interval is in beacon periods, 0 keeps the SDK default
+bool sleepMode(Sleep type, uint8_t listen_interval);
+bool phyMode(Phy mode);
+void txPower(float dbm);
+
+// Station
+
+wl_status_t status();
+int32_t rssi();
+uint8_t channel();
+const uint8_t* bssid();
+String ssid();
+String psk();
+bool stationConfig(StationConfig& config);
+IPAddress gatewayIP();
+bool hostname(const char* hostname);
+bool config(IPAddress ip, IPAddress gw, IPAddress netmask, IPAddress dns);
+bool connect(const char* ssid, const char* pass, uint8_t channel, const uint8_t* bssid);
+#if JUSTWIFI_ENABLE_ENTERPRISE
+// Credentials stay configured after connecting, so the SDK can authenticate again by itself.
+// 'kept' is set when they were already configured and only the connection was started
+bool connectEnterprise(const char* ssid, const char* username, const char* password, uint8_t channel, const uint8_t* bssid, bool& kept);
+// PEM, not copied
+void enterpriseCACert(const char* pem);
+#endif
+void autoConnect(bool enabled);
+void autoReconnect(bool enabled);
+bool disconnect();
+
+// Scan
+
+// Channel 0 scans all of them. Dwell is the time spent on each channel in ms, 0 keeps the SDK default
+bool scanStart(uint8_t channel, uint32_t dwell);
+// False when scanStart() ignores the channel and always sweeps all of them
+bool scanSingleChannel();
+int8_t scanComplete();
+bool scanResult(uint8_t index, String& ssid, uint8_t& security, int32_t& rssi, uint8_t*& bssid, int32_t& channel);
+void scanDelete();
+
+// SoftAP
+
+bool softAPConfig(IPAddress ip, IPAddress gw, IPAddress netmask);
+// Channel 0 leaves the SDK default
+bool softAP(const char* ssid, const char* pass, uint8_t channel);
+bool softAPStop();
+uint8_t softAPChannel();
+uint8_t softAPStations();
+
+// Gateway probe, ICMP echo with a single request in flight.
+// probeReply() returns true once the reply to the last probeStart() arrives, with the round trip in ms
+
+bool probeStart(IPAddress target);
+bool probeReply(uint32_t& rtt);
+void probeStop();
+
+// Warm-up after connecting. Host name lookup is asynchronous, one at a time, and the name
+// is not copied. ARP announces our address and asks for the gateway one, SNTP is restarted
+// so the time is requested right away
+
+bool resolveStart(const char* host);
+Resolve resolveStatus();
+bool arpAnnounce(IPAddress gateway);
+void sntpStart(const char* server);
+
+// Provisioning
+
+#if defined(JUSTWIFI_ENABLE_WPS)
+bool wpsStart();
+Wps wpsStatus();
+void wpsStop();
+#endif
+
+#if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+bool smartConfigStart();
+bool smartConfigDone();
+void smartConfigStop();
+#endif
+
+// Dedicated task, when supported. taskWait() blocks until taskNotify() or timeout
+
+bool taskStart(void (*task)(void*), void* arg, uint32_t stack, uint8_t priority);
+void taskWait(uint32_t ms);
+void taskNotify();
+
+} // namespace backend
+} // namespace justwifi
+
+#endif
@@ -0,0 +1,657 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#if defined(ARDUINO_ARCH_ESP32) && !defined(JUSTWIFI_BACKEND_CUSTOM) && !defined(JUSTWIFI_BACKEND_REPLAY)
+
+#include "JustWifiBackend.h"
+
+#include <esp_wifi.h>
+#include <cstring>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+#include <esp_attr.h>
+#include <esp_sleep.h>
+
+#include <lwip/apps/sntp.h>
+#include <lwip/dns.h>
+#include <lwip/etharp.h>
+#include <lwip/icmp.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/netif.h>
+#include <lwip/prot/ip4.h>
+#include <lwip/sockets.h>
+#include <lwip/tcpip.h>
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+#include <esp_wpa2.h>
+#endif
+
+// Arduino Core 2.x renamed system events
+#if defined(ESP_ARDUINO_VERSION_MAJOR) && (ESP_ARDUINO_VERSION_MAJOR >= 2)
+#define JUSTWIFI_ESP32_CORE_2 1
+#else
+#define JUSTWIFI_ESP32_CORE_2 0
+#endif
+
+#if JUSTWIFI_ENABLE_ENTERPRISE && !JUSTWIFI_ESP32_CORE_2
+    #error "WPA2-Enterprise on ESP32 requires Arduino Core 2.0.0 or later"
+#endif
+
+namespace justwifi {
+namespace backend {
+
+namespace {
+
+// Zeroed on power-on, kept through deep sleep
+RTC_DATA_ATTR uint32_t _rtc_data[JUSTWIFI_RTC_SIZE / sizeof(uint32_t)];
+
+event_handler_type _event_handler = nullptr;
+void* _event_arg = nullptr;
+bool _event_registered = false;
+
+TaskHandle_t _task = nullptr;
+
+void _event(Event event, uint8_t reason) {
+    if (_event_handler) {
+        _event_handler(_event_arg, event, reason);
+    }
+}
+
+uint8_t _security(wifi_auth_mode_t mode) {
+    switch (mode) {
+    case WIFI_AUTH_OPEN:
+        return ENC_TYPE_NONE;
+    case WIFI_AUTH_WEP:
+        return ENC_TYPE_WEP;
+    case WIFI_AUTH_WPA_PSK:
+        return ENC_TYPE_TKIP;
+    case WIFI_AUTH_WPA2_PSK:
+        return ENC_TYPE_CCMP;
+    default:
+        return ENC_TYPE_AUTO;
+    }
+}
+
+} // namespace
+
+//------------------------------------------------------------------------------
+// SYSTEM
+//------------------------------------------------------------------------------
+
+// Same value as the GetChipID example from the Arduino Core
+uint32_t chipId() {
+    uint64_t mac = ESP.getEfuseMac();
+    uint32_t id = 0;
+    for (int i = 0; i < 17; i = i + 8) {
+        id |= ((mac >> (40 - i)) & 0xff) << i;
+    }
+    return id;
+}
+
+uint32_t cycles() {
+    return ESP.getCycleCount();
+}
+
+uint32_t freeHeap() {
+    return ESP.getFreeHeap();
+}
+
+uint32_t allocations() {
+    return 0;
+}
+
+bool rtcRead(void* data, size_t size) {
+    if (size > sizeof(_rtc_data)) return false;
+    std::memcpy(data, _rtc_data, size);
+    return true;
+}
+
+bool rtcWrite(const void* data, size_t size) {
+    if (size > sizeof(_rtc_data)) return false;
+    std::memcpy(_rtc_data, data, size);
+    return true;
+}
+
+// PHY calibration data is kept in NVS by the SDK, there is nothing to choose here
+void deepSleep(uint64_t us, bool) {
+    esp_sleep_enable_timer_wakeup(us);
+    esp_deep_sleep_start();
+}
+
+//------------------------------------------------------------------------------
+// RADIO
+//------------------------------------------------------------------------------
+
+void persistent(bool enabled) {
+    WiFi.persistent(enabled);
+}
+
+uint8_t mode() {
+    return WiFi.getMode();
+}
+
+bool enableSTA(bool enabled) {
+    return WiFi.enableSTA(enabled);
+}
+
+bool enableAP(bool enabled) {
+    return WiFi.enableAP(enabled);
+}
+
+void off() {
+    WiFi.mode(WIFI_OFF);
+}
+
+// There is no forced sleep, radio is simply stopped and will be started by enableSTA / enableAP
+bool sleep() {
+    return WiFi.mode(WIFI_OFF);
+}
+
+bool wake() {
+    return true;
+}
+
+// Only modem sleep is available with the radio on. Light sleep is the deepest modem sleep level,
+// waking up every 'listen_interval' beacons instead of every DTIM
+bool sleepMode(Sleep type, uint8_t listen_interval) {
+
+    if (Sleep::None == type) {
+        return ESP_OK == esp_wifi_set_ps(WIFI_PS_NONE);
+    }
+
+    if ((Sleep::Light == type) && listen_interval) {
+        wifi_config_t config;
+        if (ESP_OK == esp_wifi_get_config(WIFI_IF_STA, &config)) {
+            config.sta.listen_interval = listen_interval;
+            esp_wifi_set_config(WIFI_IF_STA, &config);
+        }
+    }
+
+    return ESP_OK == esp_wifi_set_ps((Sleep::Light == type) ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM);
+
+}
+
+bool phyMode(Phy mode) {
+    uint8_t protocol = WIFI_PROTOCOL_11B;
+    if (Phy::G == mode) protocol |= WIFI_PROTOCOL_11G;
+    if (Phy::N == mode) protocol |= WIFI_PROTOCOL_11G | WIFI_PROTOCOL_11N;
+    return ESP_OK == esp_wifi_set_protocol(WIFI_IF_STA, protocol);
+}
+
+// Set in 0.25dBm units
+void txPower(float dbm) {
+    esp_wifi_set_max_tx_power(static_cast<int8_t>(dbm * 4));
+}
+
+void setEventHandler(event_handler_type handler, void* arg) {
+
+    _event_handler = handler;
+    _event_arg = arg;
+
+    if (_event_registered) return;
+    _event_registered = true;
+
+#if JUSTWIFI_ESP32_CORE_2
+    WiFi.onEvent([](arduino_event_id_t event, arduino_event_info_t info) {
+        switch (event) {
+        case ARDUINO_EVENT_WIFI_STA_CONNECTED:
+            _event(Event::StationConnected, 0);
+            break;
+        case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+            _event(Event::StationDisconnected, info.wifi_sta_disconnected.reason);
+            break;
+        case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+            _event(Event::StationGotIP, 0);
+            break;
+        default:
+            _event(Event::Other, 0);
+            break;
+        }
+    });
+#else
+    WiFi.onEvent([](system_event_id_t event, system_event_info_t info) {
+        switch (event) {
+        case SYSTEM_EVENT_STA_CONNECTED:
+            _event(Event::StationConnected, 0);
+            break;
+        case SYSTEM_EVENT_STA_DISCONNECTED:
+            _event(Event::StationDisconnected, info.disconnected.reason);
+            break;
+        case SYSTEM_EVENT_STA_GOT_IP:
+            _event(Event::StationGotIP, 0);
+            break;
+        default:
+            _event(Event::Other, 0);
+            break;
+        }
+    });
+#endif
+
+}
+
+//------------------------------------------------------------------------------
+// STATION
+//------------------------------------------------------------------------------
+
+wl_status_t status() {
+    return WiFi.status();
+}
+
+int32_t rssi() {
+    return WiFi.RSSI();
+}
+
+uint8_t channel() {
+    return WiFi.channel();
+}
+
+const uint8_t* bssid() {
+    return WiFi.BSSID();
+}
+
+String ssid() {
+    return WiFi.SSID();
+}
+
+String psk() {
+    return WiFi.psk();
+}
+
+bool stationConfig(StationConfig& config) {
+
+    wifi_config_t current;
+    if (ESP_OK != esp_wifi_get_config(WIFI_IF_STA, &current)) {
+        return false;
+    }
+
+    std::memcpy(config.ssid, current.sta.ssid, sizeof(current.sta.ssid));
+    config.ssid[sizeof(current.sta.ssid)] = '\0';
+    std::memcpy(config.pass, current.sta.password, sizeof(current.sta.password));
+    config.pass[sizeof(current.sta.password)] = '\0';
+
+    config.channel = 0;
+    if (WiFi.status() == WL_CONNECTED) {
+        std::memcpy(config.bssid, WiFi.BSSID(), sizeof(config.bssid));
+        config.channel = WiFi.channel();
+    } else if (current.sta.bssid_set && current.sta.channel) {
+        std::memcpy(config.bssid, current.sta.bssid, sizeof(config.bssid));
+        config.channel = current.sta.channel;
+    }
+
+    return true;
+
+}
+
+IPAddress gatewayIP() {
+    return WiFi.gatewayIP();
+}
+
+bool hostname(const char* hostname) {
+    return WiFi.setHostname(hostname);
+}
+
+bool config(IPAddress ip, IPAddress gw, IPAddress netmask, IPAddress dns) {
+    return WiFi.config(ip, gw, netmask, dns);
+}
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+
+namespace {
+
+const char* _enterprise_ca_cert = nullptr;
+
+// Identifies credentials the driver is configured with, 0 when none
+uint32_t _enterprise_config = 0;
+
+uint32_t _enterprise_hash(const char* ssid, const char* username, const char* password) {
+    uint32_t hash = 2166136261u;
+    for (const char* part : {ssid, username, password, _enterprise_ca_cert}) {
+        if (!part) continue;
+        for (const char* c = part; ; ++c) {
+            hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+            if (!*c) break;
+        }
+    }
+    return hash ? hash : 1;
+}
+
+} // namespace
+
+#endif // JUSTWIFI_ENABLE_ENTERPRISE
+
+bool connect(const char* ssid, const char* pass, uint8_t channel, const uint8_t* bssid) {
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    if (_enterprise_config) {
+        esp_wifi_sta_wpa2_ent_disable();
+        _enterprise_config = 0;
+    }
+#endif
+    if (channel) {
+        return WL_CONNECT_FAILED != WiFi.begin(ssid, pass, channel, bssid);
+    }
+    return WL_CONNECT_FAILED != WiFi.begin(ssid, pass);
+}
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+
+void enterpriseCACert(const char* pem) {
+    _enterprise_ca_cert = pem;
+    _enterprise_config = 0;
+}
+
+// WiFi.begin() reloads the whole supplicant configuration. When credentials did not change,
+// only update the target AP and reconnect. The join is still a full EAP exchange
+bool connectEnterprise(const char* ssid, const char* username, const char* password, uint8_t channel, const uint8_t* bssid, bool& kept) {
+
+    uint32_t hash = _enterprise_hash(ssid, username, password);
+    kept = (hash == _enterprise_config);
+
+    if (kept) {
+        wifi_config_t config;
+        if (ESP_OK == esp_wifi_get_config(WIFI_IF_STA, &config)) {
+            config.sta.bssid_set = channel ? 1 : 0;
+            config.sta.channel = channel;
+            if (channel) std::memcpy(config.sta.bssid, bssid, sizeof(config.sta.bssid));
+            esp_wifi_set_config(WIFI_IF_STA, &config);
+            return ESP_OK == esp_wifi_connect();
+        }
+        kept = false;
+    }
+
+    _enterprise_config = hash;
+    return WL_CONNECT_FAILED != WiFi.begin(ssid, WPA2_AUTH_PEAP, username, username, password,
+        _enterprise_ca_cert, nullptr, nullptr, channel, channel ? bssid : nullptr);
+
+}
+
+#endif // JUSTWIFI_ENABLE_ENTERPRISE
+
+void autoConnect(bool enabled) {
+    WiFi.setAutoConnect(enabled);
+}
+
+void autoReconnect(bool enabled) {
+    WiFi.setAutoReconnect(enabled);
+}
+
+bool disconnect() {
+    return WiFi.disconnect();
+}
+
+//------------------------------------------------------------------------------
+// SCAN
+//------------------------------------------------------------------------------
+
+// Core 1.x can't scan a single channel, see scanSingleChannel()
+bool scanStart(uint8_t channel, uint32_t dwell) {
+    const uint32_t max_ms_per_chan = dwell ? dwell : 300;
+#if JUSTWIFI_ESP32_CORE_2
+    return WIFI_SCAN_FAILED != WiFi.scanNetworks(true, true, false, max_ms_per_chan, channel);
+#else
+    return WIFI_SCAN_FAILED != WiFi.scanNetworks(true, true, false, max_ms_per_chan);
+#endif
+}
+
+bool scanSingleChannel() {
+    return JUSTWIFI_ESP32_CORE_2;
+}
+
+int8_t scanComplete() {
+    return WiFi.scanComplete();
+}
+
+bool scanResult(uint8_t index, String& ssid, uint8_t& security, int32_t& rssi, uint8_t*& bssid, int32_t& channel) {
+    uint8_t mode;
+    if (!WiFi.getNetworkInfo(index, ssid, mode, rssi, bssid, channel)) {
+        return false;
+    }
+    security = _security(static_cast<wifi_auth_mode_t>(mode));
+    return true;
+}
+
+void scanDelete() {
+    WiFi.scanDelete();
+}
+
+//------------------------------------------------------------------------------
+// SOFTAP
+//------------------------------------------------------------------------------
+
+bool softAPConfig(IPAddress ip, IPAddress gw, IPAddress netmask) {
+    return WiFi.softAPConfig(ip, gw, netmask);
+}
+
+bool softAP(const char* ssid, const char* pass, uint8_t channel) {
+    return WiFi.softAP(ssid, pass, channel ? channel : 1);
+}
+
+bool softAPStop() {
+    WiFi.softAPdisconnect();
+    return WiFi.enableAP(false);
+}
+
+uint8_t softAPChannel() {
+    wifi_config_t config;
+    if (ESP_OK != esp_wifi_get_config(WIFI_IF_AP, &config)) return 0;
+    return config.ap.channel;
+}
+
+uint8_t softAPStations() {
+    return WiFi.softAPgetStationNum();
+}
+
+//------------------------------------------------------------------------------
+// GATEWAY PROBE
+//------------------------------------------------------------------------------
+
+// lwIP runs in its own task here, so the probe uses a non-blocking raw socket
+// instead of the raw pcb API
+
+namespace {
+
+constexpr uint16_t ProbeId = 0x4a57;
+
+int _probe_socket = -1;
+uint16_t _probe_seq = 0;
+uint32_t _probe_sent = 0;
+
+} // namespace
+
+bool probeStart(IPAddress target) {
+
+    if (_probe_socket < 0) {
+        _probe_socket = socket(AF_INET, SOCK_RAW, IP_PROTO_ICMP);
+        if (_probe_socket < 0) return false;
+        fcntl(_probe_socket, F_SETFL, O_NONBLOCK);
+    }
+
+    icmp_echo_hdr echo;
+    ICMPH_TYPE_SET(&echo, ICMP_ECHO);
+    ICMPH_CODE_SET(&echo, 0);
+    echo.id = PP_HTONS(ProbeId);
+    echo.seqno = lwip_htons(++_probe_seq);
+    echo.chksum = 0;
+    echo.chksum = inet_chksum(&echo, sizeof(echo));
+
+    sockaddr_in address;
+    std::memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = static_cast<uint32_t>(target);
+
+    _probe_sent = millis();
+    return sizeof(echo) == sendto(_probe_socket, &echo, sizeof(echo), 0,
+        reinterpret_cast<sockaddr*>(&address), sizeof(address));
+
+}
+
+bool probeReply(uint32_t& rtt) {
+
+    if (_probe_socket < 0) return false;
+
+    uint8_t buffer[64];
+    for (;;) {
+        int size = recv(_probe_socket, buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (size <= 0) return false;
+
+        const auto* header = reinterpret_cast<const ip_hdr*>(buffer);
+        size_t offset = IPH_HL(header) * 4;
+        if (static_cast<size_t>(size) < offset + sizeof(icmp_echo_hdr)) continue;
+
+        icmp_echo_hdr echo;
+        std::memcpy(&echo, buffer + offset, sizeof(echo));
+        if ((ICMP_ER == echo.type) && (PP_HTONS(ProbeId) == echo.id) && (lwip_htons(_probe_seq) == echo.seqno)) {
+            rtt = millis() - _probe_sent;
+            return true;
+        }
+    }
+
+}
+
+void probeStop() {
+    if (_probe_socket >= 0) {
+        close(_probe_socket);
+        _probe_socket = -1;
+    }
+}
+
+//------------------------------------------------------------------------------
+// WARM-UP
+//------------------------------------------------------------------------------
+
+// DNS and ARP calls are not thread-safe, they are passed to the lwIP task instead
+
+namespace {
+
+// Lookups that timed out can still call back later, only the last one started counts
+volatile uint8_t _resolve_id = 0;
+volatile Resolve _resolve_status = Resolve::Failed;
+const char* _resolve_host = nullptr;
+uint32_t _arp_gateway = 0;
+uint32_t _arp_local = 0;
+
+void _resolve_found(const char*, const ip_addr_t* address, void* arg) {
+    if (reinterpret_cast<uintptr_t>(arg) != _resolve_id) return;
+    _resolve_status = address ? Resolve::Success : Resolve::Failed;
+}
+
+void _resolve_start(void* arg) {
+    ip_addr_t address;
+    err_t err = dns_gethostbyname(_resolve_host, &address, _resolve_found, arg);
+    if (ERR_OK == err) {
+        _resolve_found(_resolve_host, &address, arg);
+    } else if (ERR_INPROGRESS != err) {
+        _resolve_found(_resolve_host, nullptr, arg);
+    }
+}
+
+void _arp_announce(void*) {
+    for (netif* interface = netif_list; interface; interface = interface->next) {
+        if (ip4_addr_get_u32(netif_ip4_addr(interface)) != _arp_local) continue;
+
+        etharp_gratuitous(interface);
+
+        ip4_addr_t address;
+        ip4_addr_set_u32(&address, _arp_gateway);
+        etharp_request(interface, &address);
+        break;
+    }
+}
+
+} // namespace
+
+bool resolveStart(const char* host) {
+
+    _resolve_host = host;
+    _resolve_status = Resolve::Running;
+    uint8_t id = _resolve_id + 1;
+    _resolve_id = id;
+
+    if (ERR_OK != tcpip_callback(_resolve_start, reinterpret_cast<void*>(static_cast<uintptr_t>(id)))) {
+        _resolve_status = Resolve::Failed;
+        return false;
+    }
+
+    return true;
+
+}
+
+Resolve resolveStatus() {
+    return _resolve_status;
+}
+
+bool arpAnnounce(IPAddress gateway) {
+    _arp_local = static_cast<uint32_t>(WiFi.localIP());
+    _arp_gateway = static_cast<uint32_t>(gateway);
+    return ERR_OK == tcpip_callback(_arp_announce, nullptr);
+}
+
+void sntpStart(const char* server) {
+    sntp_stop();
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, const_cast<char*>(server));
+    sntp_init();
+}
+
+//------------------------------------------------------------------------------
+// PROVISIONING
+//------------------------------------------------------------------------------
+
+#if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+bool smartConfigStart() {
+    return WiFi.beginSmartConfig();
+}
+
+bool smartConfigDone() {
+    return WiFi.smartConfigDone();
+}
+
+void smartConfigStop() {
+    WiFi.stopSmartConfig();
+}
+
+#endif // defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+//------------------------------------------------------------------------------
+// TASK
+//------------------------------------------------------------------------------
+
+// WiFi driver and lwIP run on the protocol core (0), app loop() runs on the other one
+bool taskStart(void (*task)(void*), void* arg, uint32_t stack, uint8_t priority) {
+    if (_task) return false;
+    return pdPASS == xTaskCreatePinnedToCore(task, "justwifi", stack, arg, priority, &_task, 0);
+}
+
+void taskWait(uint32_t ms) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+}
+
+void taskNotify() {
+    if (_task) {
+        xTaskNotifyGive(_task);
+    }
+}
+
+} // namespace backend
+} // namespace justwifi
+
+#endif
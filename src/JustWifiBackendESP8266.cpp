@@ -0,0 +1,678 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#if !defined(ARDUINO_ARCH_ESP32) && !defined(JUSTWIFI_BACKEND_CUSTOM) && !defined(JUSTWIFI_BACKEND_REPLAY)
+
+#include "JustWifiBackend.h"
+
+#include <user_interface.h>
+#include <cstring>
+
+#include <lwip/init.h>
+#if LWIP_VERSION_MAJOR < 2
+    #error "JustWifi requires the lwIP2 variant of Arduino Core for ESP8266"
+#endif
+
+#include <lwip/apps/sntp.h>
+#include <lwip/dns.h>
+#include <lwip/etharp.h>
+#include <lwip/icmp.h>
+#include <lwip/inet_chksum.h>
+#include <lwip/netif.h>
+#include <lwip/prot/ip4.h>
+#include <lwip/raw.h>
+
+// -----------------------------------------------------------------------------
+// WPA2E support (no support from Arduino Core WiFi, needs manual SDK calls!)
+// -----------------------------------------------------------------------------
+
+#ifdef JUSTWIFI_ENABLE_ENTERPRISE
+
+#include <wpa2_enterprise.h>
+
+#endif
+
+namespace justwifi {
+namespace backend {
+
+namespace {
+
+event_handler_type _event_handler = nullptr;
+void* _event_arg = nullptr;
+
+WiFiEventHandler _connected_handler;
+WiFiEventHandler _disconnected_handler;
+WiFiEventHandler _got_ip_handler;
+
+void _event(Event event, uint8_t reason) {
+    if (_event_handler) {
+        _event_handler(_event_arg, event, reason);
+    }
+}
+
+} // namespace
+
+// -----------------------------------------------------------------------------
+// WPS callbacks
+// -----------------------------------------------------------------------------
+
+#if defined(JUSTWIFI_ENABLE_WPS)
+
+static wps_cb_status _jw_wps_status;
+
+void _jw_wps_status_cb(wps_cb_status status) {
+    _jw_wps_status = status;
+}
+
+#endif // defined(JUSTWIFI_ENABLE_WPS)
+
+//------------------------------------------------------------------------------
+// SYSTEM
+//------------------------------------------------------------------------------
+
+uint32_t chipId() {
+    return ESP.getChipId();
+}
+
+uint32_t cycles() {
+    return ESP.getCycleCount();
+}
+
+uint32_t freeHeap() {
+    return ESP.getFreeHeap();
+}
+
+uint32_t allocations() {
+    return 0;
+}
+
+// Offset is in 4 byte blocks of the user part (512 bytes)
+bool rtcRead(void* data, size_t size) {
+    return ESP.rtcUserMemoryRead(JUSTWIFI_RTC_OFFSET, static_cast<uint32_t*>(data), size);
+}
+
+bool rtcWrite(const void* data, size_t size) {
+    return ESP.rtcUserMemoryWrite(JUSTWIFI_RTC_OFFSET, static_cast<uint32_t*>(const_cast<void*>(data)), size);
+}
+
+void deepSleep(uint64_t us, bool calibrate) {
+    ESP.deepSleep(us, calibrate ? WAKE_RFCAL : WAKE_NO_RFCAL);
+}
+
+//------------------------------------------------------------------------------
+// RADIO
+//------------------------------------------------------------------------------
+
+void persistent(bool enabled) {
+    WiFi.persistent(enabled);
+}
+
+uint8_t mode() {
+    return WiFi.getMode();
+}
+
+bool enableSTA(bool enabled) {
+    return WiFi.enableSTA(enabled);
+}
+
+bool enableAP(bool enabled) {
+    return WiFi.enableAP(enabled);
+}
+
+void off() {
+    WiFi.mode(WIFI_OFF);
+}
+
+bool sleep() {
+    return WiFi.forceSleepBegin();
+}
+
+bool wake() {
+    return WiFi.forceSleepWake();
+}
+
+bool sleepMode(Sleep type, uint8_t listen_interval) {
+    switch (type) {
+    case Sleep::None:
+        return WiFi.setSleepMode(WIFI_NONE_SLEEP);
+    case Sleep::Light:
+        return WiFi.setSleepMode(WIFI_LIGHT_SLEEP, listen_interval);
+    case Sleep::Modem:
+        return WiFi.setSleepMode(WIFI_MODEM_SLEEP, listen_interval);
+    }
+    return false;
+}
+
+bool phyMode(Phy mode) {
+    switch (mode) {
+    case Phy::B:
+        return WiFi.setPhyMode(WIFI_PHY_MODE_11B);
+    case Phy::G:
+        return WiFi.setPhyMode(WIFI_PHY_MODE_11G);
+    case Phy::N:
+        return WiFi.setPhyMode(WIFI_PHY_MODE_11N);
+    }
+    return false;
+}
+
+void txPower(float dbm) {
+    WiFi.setOutputPower(dbm);
+}
+
+void setEventHandler(event_handler_type handler, void* arg) {
+
+    _event_handler = handler;
+    _event_arg = arg;
+
+    _connected_handler = WiFi.onStationModeConnected([](const WiFiEventStationModeConnected&) {
+        _event(Event::StationConnected, 0);
+    });
+
+    _disconnected_handler = WiFi.onStationModeDisconnected([](const WiFiEventStationModeDisconnected& event) {
+        _event(Event::StationDisconnected, event.reason);
+    });
+
+    _got_ip_handler = WiFi.onStationModeGotIP([](const WiFiEventStationModeGotIP&) {
+        _event(Event::StationGotIP, 0);
+    });
+
+}
+
+//------------------------------------------------------------------------------
+// STATION
+//------------------------------------------------------------------------------
+
+wl_status_t status() {
+    return WiFi.status();
+}
+
+int32_t rssi() {
+    return WiFi.RSSI();
+}
+
+uint8_t channel() {
+    return WiFi.channel();
+}
+
+const uint8_t* bssid() {
+    return WiFi.BSSID();
+}
+
+String ssid() {
+    return WiFi.SSID();
+}
+
+String psk() {
+    return WiFi.psk();
+}
+
+bool stationConfig(StationConfig& config) {
+
+    station_config current;
+    if (!wifi_station_get_config(&current)) {
+        return false;
+    }
+
+    std::memcpy(config.ssid, current.ssid, sizeof(current.ssid));
+    config.ssid[sizeof(current.ssid)] = '\0';
+    std::memcpy(config.pass, current.password, sizeof(current.password));
+    config.pass[sizeof(current.password)] = '\0';
+
+    // station_config has no channel and wifi_get_channel() is wherever the radio sits now,
+    // so the AP is only pinned once connected. Otherwise the SDK looks for it
+    config.channel = 0;
+    if (WiFi.status() == WL_CONNECTED) {
+        std::memcpy(config.bssid, WiFi.BSSID(), sizeof(config.bssid));
+        config.channel = WiFi.channel();
+    }
+
+    return true;
+
+}
+
+IPAddress gatewayIP() {
+    return WiFi.gatewayIP();
+}
+
+bool hostname(const char* hostname) {
+    return WiFi.hostname(hostname);
+}
+
+bool config(IPAddress ip, IPAddress gw, IPAddress netmask, IPAddress dns) {
+    return WiFi.config(ip, gw, netmask, dns);
+}
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+
+namespace {
+
+const char* _enterprise_ca_cert = nullptr;
+
+// Identifies credentials the SDK is configured with, 0 when none
+uint32_t _enterprise_config = 0;
+
+uint32_t _enterprise_hash(const char* ssid, const char* username, const char* password) {
+    uint32_t hash = 2166136261u;
+    for (const char* part : {ssid, username, password, _enterprise_ca_cert}) {
+        if (!part) continue;
+        for (const char* c = part; ; ++c) {
+            hash = (hash ^ static_cast<uint8_t>(*c)) * 16777619u;
+            if (!*c) break;
+        }
+    }
+    return hash ? hash : 1;
+}
+
+void _enterprise_clear() {
+    wifi_station_set_wpa2_enterprise_auth(0);
+    wifi_station_clear_enterprise_identity();
+    wifi_station_clear_enterprise_username();
+    wifi_station_clear_enterprise_password();
+    wifi_station_clear_cert_key();
+    wifi_station_clear_enterprise_ca_cert();
+    _enterprise_config = 0;
+}
+
+} // namespace
+
+#endif // JUSTWIFI_ENABLE_ENTERPRISE
+
+bool connect(const char* ssid, const char* pass, uint8_t channel, const uint8_t* bssid) {
+#if JUSTWIFI_ENABLE_ENTERPRISE
+    if (_enterprise_config) {
+        _enterprise_clear();
+    }
+#endif
+    if (channel) {
+        return WL_CONNECT_FAILED != WiFi.begin(ssid, pass, channel, bssid);
+    }
+    return WL_CONNECT_FAILED != WiFi.begin(ssid, pass);
+}
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+
+void enterpriseCACert(const char* pem) {
+    _enterprise_ca_cert = pem;
+    _enterprise_config = 0;
+}
+
+bool connectEnterprise(const char* ssid, const char* username, const char* password, uint8_t channel, const uint8_t* bssid, bool& kept) {
+
+    // **Note**: this will only work with PEAP/TTPS configurations, see:
+    // https://github.com/xoseperez/justwifi/pull/18
+
+    uint32_t hash = _enterprise_hash(ssid, username, password);
+    kept = (hash == _enterprise_config);
+
+    // We need to manually do the connection, without WiFi.begin()
+    station_config wifi_config{};
+
+    // c/p from ESP8266WiFiSTA
+    // since we never pass along the real SSID size, we depend on '\0' < 32 and no '\0' when exactly 32
+    if (sizeof(wifi_config.ssid) == strlen(ssid)) {
+        std::memcpy(reinterpret_cast<char*>(wifi_config.ssid), ssid, sizeof(wifi_config.ssid));
+    } else {
+        std::strcpy(reinterpret_cast<char*>(wifi_config.ssid), ssid);
+    }
+
+    wifi_config.bssid_set = 0;
+    if (channel) {
+        wifi_config.bssid_set = 1;
+        std::memcpy(reinterpret_cast<uint8_t*>(wifi_config.bssid), bssid, sizeof(wifi_config.bssid));
+    }
+
+    *wifi_config.password = 0;
+
+    // TODO: from ESP8266WiFiSTA, we see following calls around most of these funcs
+    // > ETS_UART_INTR_DISABLE();
+    // > ... call something() ...
+    // > ETS_UART_INTR_ENABLE();
+    // Do we need those? e.g., nodemcu-firmware code does not bother with this lock:
+    // e.g. https://github.com/nodemcu/nodemcu-firmware/blob/...branch.../app/modules/wifi.c
+    wifi_set_opmode_current(wifi_get_opmode() | STATION_MODE);
+    wifi_station_set_config_current(&wifi_config);
+
+    // Identity, CA certificate and the auth flag are kept by the SDK between attempts and
+    // used by its own reconnects, only (re)load them when something changed
+    if (!kept) {
+        _enterprise_clear();
+        wifi_station_set_enterprise_disable_time_check(1);
+        if (_enterprise_ca_cert) {
+            wifi_station_set_enterprise_ca_cert((uint8_t*)_enterprise_ca_cert, strlen(_enterprise_ca_cert) + 1);
+        }
+
+        // Note: this is safe on ESP b/c we use -funsigned-char
+        wifi_station_set_enterprise_identity((uint8_t*)username, strlen(username));
+        wifi_station_set_enterprise_username((uint8_t*)username, strlen(username));
+        wifi_station_set_enterprise_password((uint8_t*)password, strlen(password));
+        wifi_station_set_wpa2_enterprise_auth(1);
+        _enterprise_config = hash;
+    }
+
+    bool result = wifi_station_connect();
+    if (channel) {
+        wifi_set_channel(channel);
+    }
+
+    return result;
+
+}
+
+#endif // JUSTWIFI_ENABLE_ENTERPRISE
+
+void autoConnect(bool enabled) {
+    WiFi.setAutoConnect(enabled);
+}
+
+void autoReconnect(bool enabled) {
+    WiFi.setAutoReconnect(enabled);
+}
+
+bool disconnect() {
+    return WiFi.disconnect();
+}
+
+//------------------------------------------------------------------------------
+// SCAN
+//------------------------------------------------------------------------------
+
+// Dwell time is not exposed by the Arduino scan API, SDK default is used
+bool scanStart(uint8_t channel, uint32_t) {
+    return WIFI_SCAN_FAILED != WiFi.scanNetworks(true, true, channel);
+}
+
+bool scanSingleChannel() {
+    return true;
+}
+
+int8_t scanComplete() {
+    return WiFi.scanComplete();
+}
+
+bool scanResult(uint8_t index, String& ssid, uint8_t& security, int32_t& rssi, uint8_t*& bssid, int32_t& channel) {
+    bool hidden;
+    return WiFi.getNetworkInfo(index, ssid, security, rssi, bssid, channel, hidden);
+}
+
+void scanDelete() {
+    WiFi.scanDelete();
+}
+
+//------------------------------------------------------------------------------
+// SOFTAP
+//------------------------------------------------------------------------------
+
+bool softAPConfig(IPAddress ip, IPAddress gw, IPAddress netmask) {
+    return WiFi.softAPConfig(ip, gw, netmask);
+}
+
+bool softAP(const char* ssid, const char* pass, uint8_t channel) {
+    return WiFi.softAP(ssid, pass, channel ? channel : 1);
+}
+
+bool softAPStop() {
+    WiFi.softAPdisconnect();
+    return WiFi.enableAP(false);
+}
+
+uint8_t softAPChannel() {
+    softap_config config;
+    if (!wifi_softap_get_config(&config)) return 0;
+    return config.channel;
+}
+
+uint8_t softAPStations() {
+    return WiFi.softAPgetStationNum();
+}
+
+//------------------------------------------------------------------------------
+// GATEWAY PROBE
+//------------------------------------------------------------------------------
+
+// Raw pcb callbacks run in the SDK context, same as loop(), so no locking is needed
+
+namespace {
+
+constexpr uint16_t ProbeId = 0x4a57;
+
+raw_pcb* _probe_pcb = nullptr;
+uint16_t _probe_seq = 0;
+uint32_t _probe_sent = 0;
+uint32_t _probe_rtt = 0;
+bool _probe_replied = false;
+
+u8_t _probe_recv(void*, raw_pcb*, pbuf* p, const ip_addr_t*) {
+
+    const auto* header = static_cast<const ip_hdr*>(p->payload);
+
+    icmp_echo_hdr echo;
+    if (pbuf_copy_partial(p, &echo, sizeof(echo), IPH_HL(header) * 4) != sizeof(echo)) {
+        return 0;
+    }
+
+    // Not ours, let lwIP handle it
+    if ((ICMP_ER != echo.type) || (PP_HTONS(ProbeId) != echo.id) || (lwip_htons(_probe_seq) != echo.seqno)) {
+        return 0;
+    }
+
+    _probe_rtt = millis() - _probe_sent;
+    _probe_replied = true;
+    pbuf_free(p);
+
+    return 1;
+
+}
+
+} // namespace
+
+bool probeStart(IPAddress target) {
+
+    if (!_probe_pcb) {
+        _probe_pcb = raw_new(IP_PROTO_ICMP);
+        if (!_probe_pcb) return false;
+        raw_recv(_probe_pcb, _probe_recv, nullptr);
+        raw_bind(_probe_pcb, IP_ADDR_ANY);
+    }
+
+    pbuf* p = pbuf_alloc(PBUF_IP, sizeof(icmp_echo_hdr), PBUF_RAM);
+    if (!p) return false;
+
+    auto* echo = static_cast<icmp_echo_hdr*>(p->payload);
+    ICMPH_TYPE_SET(echo, ICMP_ECHO);
+    ICMPH_CODE_SET(echo, 0);
+    echo->id = PP_HTONS(ProbeId);
+    echo->seqno = lwip_htons(++_probe_seq);
+    echo->chksum = 0;
+    echo->chksum = inet_chksum(echo, sizeof(icmp_echo_hdr));
+
+    ip_addr_t address;
+    IP_ADDR4(&address, target[0], target[1], target[2], target[3]);
+
+    _probe_replied = false;
+    _probe_sent = millis();
+    err_t err = raw_sendto(_probe_pcb, p, &address);
+    pbuf_free(p);
+
+    return ERR_OK == err;
+
+}
+
+bool probeReply(uint32_t& rtt) {
+    if (!_probe_replied) return false;
+    rtt = _probe_rtt;
+    return true;
+}
+
+void probeStop() {
+    if (_probe_pcb) {
+        raw_remove(_probe_pcb);
+        _probe_pcb = nullptr;
+    }
+    _probe_replied = false;
+}
+
+//------------------------------------------------------------------------------
+// WARM-UP
+//------------------------------------------------------------------------------
+
+namespace {
+
+// Lookups that timed out can still call back later, only the last one started counts
+uint8_t _resolve_id = 0;
+Resolve _resolve_status = Resolve::Failed;
+
+void _resolve_found(const char*, const ip_addr_t* address, void* arg) {
+    if (reinterpret_cast<uintptr_t>(arg) != _resolve_id) return;
+    _resolve_status = address ? Resolve::Success : Resolve::Failed;
+}
+
+netif* _station_netif() {
+    const uint32_t local = WiFi.localIP();
+    for (netif* interface = netif_list; interface; interface = interface->next) {
+        if (ip4_addr_get_u32(netif_ip4_addr(interface)) == local) return interface;
+    }
+    return nullptr;
+}
+
+} // namespace
+
+bool resolveStart(const char* host) {
+
+    ++_resolve_id;
+    _resolve_status = Resolve::Running;
+
+    ip_addr_t address;
+    err_t err = dns_gethostbyname(host, &address, _resolve_found,
+        reinterpret_cast<void*>(static_cast<uintptr_t>(_resolve_id)));
+
+    // Already cached
+    if (ERR_OK == err) {
+        _resolve_status = Resolve::Success;
+        return true;
+    }
+
+    if (ERR_INPROGRESS != err) {
+        _resolve_status = Resolve::Failed;
+        return false;
+    }
+
+    return true;
+
+}
+
+Resolve resolveStatus() {
+    return _resolve_status;
+}
+
+bool arpAnnounce(IPAddress gateway) {
+
+    netif* interface = _station_netif();
+    if (!interface) return false;
+
+    etharp_gratuitous(interface);
+
+    ip4_addr_t address;
+    IP4_ADDR(&address, gateway[0], gateway[1], gateway[2], gateway[3]);
+    return ERR_OK == etharp_request(interface, &address);
+
+}
+
+void sntpStart(const char* server) {
+    sntp_stop();
+    sntp_setoperatingmode(SNTP_OPMODE_POLL);
+    sntp_setservername(0, const_cast<char*>(server));
+    sntp_init();
+}
+
+//------------------------------------------------------------------------------
+// PROVISIONING
+//------------------------------------------------------------------------------
+
+#if defined(JUSTWIFI_ENABLE_WPS)
+
+bool wpsStart() {
+
+    if (!wifi_wps_disable()) {
+        return false;
+    }
+
+    // so far only WPS_TYPE_PBC is supported (SDK 1.2.0)
+    if (!wifi_wps_enable(WPS_TYPE_PBC)) {
+        return false;
+    }
+
+    _jw_wps_status = (wps_cb_status) 5;
+    if (!wifi_set_wps_cb((wps_st_cb_t) &_jw_wps_status_cb)) {
+        return false;
+    }
+
+    return wifi_wps_start();
+
+}
+
+Wps wpsStatus() {
+    if (5 == _jw_wps_status) return Wps::Running;
+    if (WPS_CB_ST_SUCCESS == _jw_wps_status) return Wps::Success;
+    return Wps::Failed;
+}
+
+void wpsStop() {
+    wifi_wps_disable();
+}
+
+#endif // defined(JUSTWIFI_ENABLE_WPS)
+
+#if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+bool smartConfigStart() {
+    return WiFi.beginSmartConfig();
+}
+
+bool smartConfigDone() {
+    return WiFi.smartConfigDone();
+}
+
+void smartConfigStop() {
+    WiFi.stopSmartConfig();
+}
+
+#endif // defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+//------------------------------------------------------------------------------
+// TASK
+//------------------------------------------------------------------------------
+
+// Everything runs in the single Arduino loop task here
+
+bool taskStart(void (*)(void*), void*, uint32_t, uint8_t) {
+    return false;
+}
+
+void taskWait(uint32_t) {
+}
+
+void taskNotify() {
+}
+
+} // namespace backend
+} // namespace justwifi
+
+#endif
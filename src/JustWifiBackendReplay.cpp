@@ -0,0 +1,713 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#if defined(JUSTWIFI_BACKEND_REPLAY)
+
+#include "JustWifiReplay.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace justwifi {
+namespace replay {
+
+namespace {
+
+constexpr size_t None = SIZE_MAX;
+
+const justwifi_input_t* _inputs = nullptr;
+size_t _size = 0;
+uint32_t _clock = 0;
+
+size_t _scan = None;
+size_t _scan_next = 0;
+uint32_t _scan_start = 0;
+
+size_t _attempt = None;
+size_t _attempt_next = 0;
+uint32_t _attempt_start = 0;
+
+uint8_t _rtc[JUSTWIFI_RTC_SIZE] {};
+bool _rtc_written = false;
+uint64_t _slept = 0;
+
+// Radio channel changes, 0 while sweeping every channel
+struct Tune {
+    uint32_t time;
+    uint8_t channel;
+};
+
+std::vector<Tune> _timeline;
+uint8_t _home = 0;
+uint8_t _ap_channel = 0;
+
+// SoftAP starts and stops (channel 0), and the clients it serves
+std::vector<Tune> _ap_timeline;
+uint8_t _stations = 0;
+uint32_t _rejoin = 0;
+
+bool _single_channel = true;
+
+void _tune(uint32_t time, uint8_t channel) {
+    _timeline.push_back(Tune{time, channel});
+}
+
+size_t _resolve = None;
+size_t _resolve_next = 0;
+uint32_t _resolve_start = 0;
+
+size_t _probe = None;
+size_t _probe_next = 0;
+uint32_t _probe_start = 0;
+
+size_t _provision = None;
+size_t _provision_next = 0;
+#if defined(JUSTWIFI_ENABLE_WPS) || defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+uint32_t _provision_start = 0;
+#endif
+
+std::string _enterprise;
+
+allocations_type _allocations = nullptr;
+
+backend::event_handler_type _handler = nullptr;
+void* _handler_arg = nullptr;
+wl_status_t _reported = WL_DISCONNECTED;
+
+// SDK reason codes for the replayed status changes
+uint8_t _reason(wl_status_t status) {
+    switch (status) {
+    case WL_NO_SSID_AVAIL:
+        return 201;     // NO_AP_FOUND
+    case WL_CONNECT_FAILED:
+        return 15;      // 4WAY_HANDSHAKE_TIMEOUT
+    case WL_CONNECTION_LOST:
+        return 200;     // BEACON_TIMEOUT
+    case WL_DISCONNECTED:
+        return 8;       // ASSOC_LEAVE
+    default:
+        return 0;
+    }
+}
+
+// Station events, sent when the clock moves like the SDK would send them
+void _events() {
+
+    auto current = backend::status();
+    if (current == _reported) return;
+
+    bool connected = (WL_CONNECTED == current);
+    bool failed = (WL_CONNECTED == _reported) || (WL_DISCONNECTED != current);
+    _reported = current;
+    if (!_handler) return;
+
+    if (connected) {
+        _handler(_handler_arg, backend::Event::StationConnected, 0);
+        _handler(_handler_arg, backend::Event::StationGotIP, 0);
+    } else if (failed && _reason(current)) {
+        _handler(_handler_arg, backend::Event::StationDisconnected, _reason(current));
+    }
+
+}
+
+// Next record of the given type after 'from', wrapping around once so the capture repeats
+size_t _find(justwifi_input_types_t type, size_t from, const char* ssid = nullptr) {
+    for (size_t offset = 0; offset < _size; ++offset) {
+        size_t index = (from + offset) % _size;
+        if (type != _inputs[index].type) continue;
+        if (ssid && strncmp(ssid, _inputs[index].ssid, sizeof(_inputs[index].ssid) - 1)) continue;
+        return index;
+    }
+    return None;
+}
+
+// Attempt is over, radio goes back to the AP channel when there is one
+void _leave() {
+    _attempt = None;
+    if (_ap_channel && (_home != _ap_channel)) {
+        _home = _ap_channel;
+        _tune(_clock, _home);
+    }
+}
+
+} // namespace
+
+void load(const justwifi_input_t* inputs, size_t size) {
+    _inputs = inputs;
+    _size = size;
+    _clock = 0;
+    _scan = _attempt = _resolve = _probe = _provision = None;
+    _timeline.clear();
+    _ap_timeline.clear();
+    _home = _ap_channel = 0;
+    _scan_next = _attempt_next = _resolve_next = _probe_next = _provision_next = 0;
+    _enterprise.clear();
+    _reported = WL_DISCONNECTED;
+}
+
+uint32_t now() {
+    return _clock;
+}
+
+void advance(uint32_t ms) {
+    _clock += ms;
+    _events();
+}
+
+uint32_t run(JustWifi& instance, uint32_t step, uint32_t limit) {
+    uint32_t start = _clock;
+    while (_clock - start < limit) {
+        instance.loop();
+        if (instance.connected()) {
+            return std::max<uint32_t>(_clock - start, 1);
+        }
+        advance(step);
+    }
+    return 0;
+}
+
+uint32_t away(uint8_t channel, uint32_t* longest) {
+
+    // Scans add their return to the home channel ahead of time
+    auto timeline = _timeline;
+    std::stable_sort(timeline.begin(), timeline.end(), [](const Tune& lhs, const Tune& rhs) {
+        return lhs.time < rhs.time;
+    });
+    timeline.push_back(Tune{_clock, 0});
+
+    uint32_t total = 0;
+    uint32_t window = 0;
+    uint32_t max = 0;
+    uint32_t since = 0;
+    uint8_t current = 0;
+
+    for (const auto& tune : timeline) {
+        uint32_t until = std::min(tune.time, _clock);
+        if (until > since) {
+            if (current != channel) {
+                total += until - since;
+                window += until - since;
+                max = std::max(max, window);
+            } else {
+                window = 0;
+            }
+            since = until;
+        }
+        current = tune.channel;
+    }
+
+    if (longest) *longest = max;
+    return total;
+
+}
+
+void setAllocations(allocations_type counter) {
+    _allocations = counter;
+}
+
+void setSingleChannel(bool supported) {
+    _single_channel = supported;
+}
+
+void setStations(uint8_t count, uint32_t rejoin) {
+    _stations = count;
+    _rejoin = rejoin;
+}
+
+uint32_t downtime(uint32_t* longest) {
+
+    struct Change {
+        uint32_t time;
+        bool ap;
+        uint8_t channel;
+    };
+
+    std::vector<Change> changes;
+    for (const auto& tune : _timeline) {
+        changes.push_back(Change{tune.time, false, tune.channel});
+    }
+    for (const auto& tune : _ap_timeline) {
+        changes.push_back(Change{tune.time, true, tune.channel});
+    }
+    std::stable_sort(changes.begin(), changes.end(), [](const Change& lhs, const Change& rhs) {
+        return lhs.time < rhs.time;
+    });
+
+    uint8_t radio = 0;
+    uint8_t ap = 0;
+    bool started = false;
+    uint32_t rejoined = 0;
+
+    uint32_t total = 0;
+    uint32_t window = 0;
+    uint32_t max = 0;
+
+    // Millisecond by millisecond, captures are short
+    size_t next = 0;
+    for (uint32_t time = 0; time < _clock; ++time) {
+        for (; (next < changes.size()) && (changes[next].time <= time); ++next) {
+            const auto& change = changes[next];
+            if (!change.ap) {
+                radio = change.channel;
+                continue;
+            }
+            if (change.channel && started) {
+                rejoined = change.time + _rejoin;
+            }
+            started = started || change.channel;
+            ap = change.channel;
+        }
+
+        if (started && (!ap || (radio != ap) || (time < rejoined))) {
+            ++total;
+            max = std::max(max, ++window);
+        } else {
+            window = 0;
+        }
+    }
+
+    if (longest) *longest = max;
+    return total;
+
+}
+
+} // namespace replay
+
+namespace backend {
+
+using namespace replay;
+
+//------------------------------------------------------------------------------
+// SYSTEM
+//------------------------------------------------------------------------------
+
+uint32_t chipId() {
+    return 0;
+}
+
+// Real host time as 80 MHz cycles, so the profiling counters read like the ESP8266 ones.
+// Wraps like the device counter does, after ~53s, single calls are never that long
+uint32_t cycles() {
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    return static_cast<uint32_t>(ns * 2 / 25);
+}
+
+bool rtcRead(void* data, size_t size) {
+    if (!_rtc_written || (size > sizeof(_rtc))) return false;
+    std::memcpy(data, _rtc, size);
+    return true;
+}
+
+bool rtcWrite(const void* data, size_t size) {
+    if (size > sizeof(_rtc)) return false;
+    std::memcpy(_rtc, data, size);
+    _rtc_written = true;
+    return true;
+}
+
+// Returns, so the host can run the next cycle with the same RTC memory
+void deepSleep(uint64_t us, bool) {
+    _slept += us;
+}
+
+uint32_t freeHeap() {
+    return 0;
+}
+
+uint32_t allocations() {
+    return _allocations ? _allocations() : 0;
+}
+
+//------------------------------------------------------------------------------
+// RADIO
+//------------------------------------------------------------------------------
+
+void persistent(bool) {
+}
+
+uint8_t mode() {
+    return WIFI_STA;
+}
+
+bool enableSTA(bool enabled) {
+    if (!enabled) _leave();
+    return true;
+}
+
+bool enableAP(bool) {
+    return true;
+}
+
+void off() {
+    _attempt = None;
+}
+
+bool sleep() {
+    _attempt = None;
+    return true;
+}
+
+bool wake() {
+    return true;
+}
+
+void setEventHandler(event_handler_type handler, void* arg) {
+    _handler = handler;
+    _handler_arg = arg;
+}
+
+bool sleepMode(Sleep, uint8_t) {
+    return true;
+}
+
+bool phyMode(Phy) {
+    return true;
+}
+
+void txPower(float) {
+}
+
+//------------------------------------------------------------------------------
+// STATION
+//------------------------------------------------------------------------------
+
+wl_status_t status() {
+
+    if (None == _attempt) return WL_DISCONNECTED;
+
+    auto result = static_cast<wl_status_t>(_inputs[_attempt].value);
+    uint32_t elapsed = _clock - _attempt_start;
+    for (size_t index = _attempt + 1; (index < _size) && (INPUT_STATUS == _inputs[index].type); ++index) {
+        if (_inputs[index].time > elapsed) break;
+        result = static_cast<wl_status_t>(_inputs[index].value);
+    }
+
+    return result;
+
+}
+
+int32_t rssi() {
+    return (None == _attempt) ? 0 : _inputs[_attempt].rssi;
+}
+
+uint8_t channel() {
+    return _home;
+}
+
+const uint8_t* bssid() {
+    static const uint8_t none[6] {};
+    return (None == _attempt) ? none : _inputs[_attempt].bssid;
+}
+
+String ssid() {
+    return (None == _attempt) ? String() : String(_inputs[_attempt].ssid);
+}
+
+String psk() {
+    return String();
+}
+
+// Network of the last provisioning record, without a passphrase
+bool stationConfig(StationConfig& config) {
+
+    if (None == _provision) return false;
+
+    const auto& input = _inputs[_provision];
+    config = StationConfig{};
+    std::memcpy(config.ssid, input.ssid, sizeof(config.ssid) - 1);
+    config.ssid[sizeof(config.ssid) - 1] = '\0';
+    std::memcpy(config.bssid, input.bssid, sizeof(config.bssid));
+    config.channel = input.channel;
+
+    return true;
+
+}
+
+IPAddress gatewayIP() {
+    return (WL_CONNECTED == status()) ? IPAddress(192, 168, 4, 1) : IPAddress();
+}
+
+bool hostname(const char*) {
+    return true;
+}
+
+bool config(IPAddress, IPAddress, IPAddress, IPAddress) {
+    return true;
+}
+
+// Attempts to an SSID that was never recorded never connect
+bool connect(const char* ssid, const char*, uint8_t, const uint8_t*) {
+    _attempt = _find(INPUT_CONNECT, _attempt_next, ssid);
+    if (None != _attempt) {
+        _attempt_next = _attempt + 1;
+        _home = _inputs[_attempt].channel;
+        _tune(_clock, _home);
+    }
+    _attempt_start = _clock;
+    return true;
+}
+
+#if JUSTWIFI_ENABLE_ENTERPRISE
+
+// Credentials are kept between attempts like on the device
+bool connectEnterprise(const char* ssid, const char* username, const char* password, uint8_t channel, const uint8_t* bssid, bool& kept) {
+
+    std::string credentials(ssid);
+    credentials.append(1, '\0').append(username).append(1, '\0').append(password);
+    kept = (credentials == _enterprise);
+    _enterprise = credentials;
+
+    return connect(ssid, nullptr, channel, bssid);
+
+}
+
+void enterpriseCACert(const char*) {
+}
+
+#endif // JUSTWIFI_ENABLE_ENTERPRISE
+
+void autoConnect(bool) {
+}
+
+void autoReconnect(bool) {
+}
+
+bool disconnect() {
+    _leave();
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// SCAN
+//------------------------------------------------------------------------------
+
+// Recorded results are returned as they are, whatever the channel
+bool scanStart(uint8_t channel, uint32_t) {
+    _scan = _find(INPUT_SCAN, _scan_next);
+    if (None != _scan) {
+        _scan_next = _scan + 1;
+        _tune(_clock, _single_channel ? channel : 0);
+        _tune(_clock + _inputs[_scan].time, _home);
+    }
+    _scan_start = _clock;
+    return true;
+}
+
+bool scanSingleChannel() {
+    return _single_channel;
+}
+
+int8_t scanComplete() {
+    if (None == _scan) return 0;
+    if (_clock - _scan_start < _inputs[_scan].time) return WIFI_SCAN_RUNNING;
+    return static_cast<int8_t>(_inputs[_scan].value);
+}
+
+bool scanResult(uint8_t index, String& ssid, uint8_t& security, int32_t& rssi, uint8_t*& bssid, int32_t& channel) {
+
+    if (None == _scan) return false;
+
+    // Results follow the scan record, but the ones that failed to read were not recorded
+    for (size_t position = _scan + 1; (position < _size) && (INPUT_SCAN_RESULT == _inputs[position].type); ++position) {
+        const auto& input = _inputs[position];
+        if (input.value != index) continue;
+        ssid = input.ssid;
+        security = input.security;
+        rssi = input.rssi;
+        bssid = const_cast<uint8_t*>(input.bssid);
+        channel = input.channel;
+        return true;
+    }
+
+    return false;
+
+}
+
+void scanDelete() {
+    _scan = None;
+}
+
+//------------------------------------------------------------------------------
+// SOFTAP
+//------------------------------------------------------------------------------
+
+bool softAPConfig(IPAddress, IPAddress, IPAddress) {
+    return true;
+}
+
+// Station channel wins when both are up, like on the device
+bool softAP(const char*, const char*, uint8_t channel) {
+    _ap_channel = channel ? channel : 1;
+    _ap_timeline.push_back(Tune{_clock, _ap_channel});
+    if (None == _attempt) {
+        _home = _ap_channel;
+        _tune(_clock, _home);
+    }
+    return true;
+}
+
+bool softAPStop() {
+    if (_ap_channel) {
+        _ap_timeline.push_back(Tune{_clock, 0});
+    }
+    _ap_channel = 0;
+    return true;
+}
+
+uint8_t softAPChannel() {
+    if (_ap_channel && (WL_CONNECTED == status())) return _home;
+    return _ap_channel;
+}
+
+uint8_t softAPStations() {
+    return _ap_channel ? _stations : 0;
+}
+
+//------------------------------------------------------------------------------
+// GATEWAY PROBE
+//------------------------------------------------------------------------------
+
+// Recorded probes stand in for the gateway, lost ones never reply. Without any, probes are not sent
+bool probeStart(IPAddress) {
+    _probe = _find(INPUT_PROBE, _probe_next);
+    if (None == _probe) return false;
+    _probe_next = _probe + 1;
+    _probe_start = _clock;
+    return true;
+}
+
+bool probeReply(uint32_t& rtt) {
+    if ((None == _probe) || !_inputs[_probe].value) return false;
+    if (_clock - _probe_start < _inputs[_probe].time) return false;
+    rtt = _inputs[_probe].time;
+    _probe = None;
+    return true;
+}
+
+void probeStop() {
+    _probe = None;
+}
+
+//------------------------------------------------------------------------------
+// WARM-UP
+//------------------------------------------------------------------------------
+
+// Recorded lookups stand in for the DNS server, answering after the same delay
+bool resolveStart(const char* host) {
+    _resolve = _find(INPUT_RESOLVE, _resolve_next, host);
+    if (None != _resolve) _resolve_next = _resolve + 1;
+    _resolve_start = _clock;
+    return true;
+}
+
+Resolve resolveStatus() {
+    if (None == _resolve) return Resolve::Failed;
+    if (_clock - _resolve_start < _inputs[_resolve].time) return Resolve::Running;
+    return _inputs[_resolve].value ? Resolve::Success : Resolve::Failed;
+}
+
+bool arpAnnounce(IPAddress) {
+    return true;
+}
+
+void sntpStart(const char*) {
+}
+
+//------------------------------------------------------------------------------
+// PROVISIONING
+//------------------------------------------------------------------------------
+
+// Both finish after the recorded time with the recorded network, fail without a record
+
+#if defined(JUSTWIFI_ENABLE_WPS) || defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+namespace {
+
+bool _provisionStart() {
+    _provision = _find(INPUT_PROVISION, _provision_next);
+    if (None == _provision) return false;
+    _provision_next = _provision + 1;
+    _provision_start = _clock;
+    return true;
+}
+
+bool _provisionDone() {
+    return (None != _provision) && (_clock - _provision_start >= _inputs[_provision].time);
+}
+
+} // namespace
+
+#endif
+
+#if defined(JUSTWIFI_ENABLE_WPS)
+
+bool wpsStart() {
+    return _provisionStart();
+}
+
+Wps wpsStatus() {
+    if (None == _provision) return Wps::Failed;
+    return _provisionDone() ? Wps::Success : Wps::Running;
+}
+
+void wpsStop() {
+}
+
+#endif // defined(JUSTWIFI_ENABLE_WPS)
+
+#if defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+bool smartConfigStart() {
+    return _provisionStart();
+}
+
+bool smartConfigDone() {
+    return _provisionDone();
+}
+
+void smartConfigStop() {
+}
+
+#endif // defined(JUSTWIFI_ENABLE_SMARTCONFIG)
+
+//------------------------------------------------------------------------------
+// TASK
+//------------------------------------------------------------------------------
+
+bool taskStart(void (*)(void*), void*, uint32_t, uint8_t) {
+    return false;
+}
+
+void taskWait(uint32_t) {
+}
+
+void taskNotify() {
+}
+
+} // namespace backend
+} // namespace justwifi
+
+#endif // defined(JUSTWIFI_BACKEND_REPLAY)
@@ -0,0 +1,108 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef JustWifiQueue_h
+#define JustWifiQueue_h
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace justwifi {
+
+// Bounded multiple-producer single-consumer queue, without locks.
+// Every cell has a sequence number telling whether it is free for the producer
+// holding that position or ready for the consumer (D. Vyukov's bounded queue).
+// push() is safe to call from any task or callback, but not from an ISR: the callers allocate
+// and may spin on the position. pop() only from one place (JustWifi::loop())
+template <typename T, size_t Size>
+class Queue {
+
+    static_assert((Size >= 2) && ((Size & (Size - 1)) == 0), "Size must be a power of 2");
+
+    public:
+
+        Queue() {
+            for (size_t index = 0; index < Size; ++index) {
+                _cells[index].sequence.store(index, std::memory_order_relaxed);
+            }
+        }
+
+        bool push(const T& data) {
+
+            Cell* cell;
+            size_t position = _push.load(std::memory_order_relaxed);
+
+            for (;;) {
+                cell = &_cells[position & (Size - 1)];
+                size_t sequence = cell->sequence.load(std::memory_order_acquire);
+                intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+                if (0 == diff) {
+                    if (_push.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        break;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    position = _push.load(std::memory_order_relaxed);
+                }
+            }
+
+            cell->data = data;
+            cell->sequence.store(position + 1, std::memory_order_release);
+
+            return true;
+
+        }
+
+        bool pop(T& data) {
+
+            Cell& cell = _cells[_pop & (Size - 1)];
+            size_t sequence = cell.sequence.load(std::memory_order_acquire);
+            if (static_cast<intptr_t>(sequence) - static_cast<intptr_t>(_pop + 1) < 0) {
+                return false;
+            }
+
+            data = cell.data;
+            cell.sequence.store(_pop + Size, std::memory_order_release);
+            ++_pop;
+
+            return true;
+
+        }
+
+    private:
+
+        struct Cell {
+            std::atomic<size_t> sequence;
+            T data;
+        };
+
+        Cell _cells[Size];
+        std::atomic<size_t> _push { 0 };
+        size_t _pop { 0 };
+
+};
+
+} // namespace justwifi
+
+#endif
@@ -0,0 +1,73 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+#ifndef JustWifiReplay_h
+#define JustWifiReplay_h
+
+#include "JustWifi.h"
+
+// Replays inputs captured with JustWifi::setRecorder(), when built with -DJUSTWIFI_BACKEND_REPLAY.
+// Meant for host builds: scans take the recorded time and return the recorded results, connection
+// attempts to an SSID replay the status changes of the next recorded attempt to the same SSID.
+// Gateway probes, warm-up lookups and WPS / SmartConfig results are answered by the next record
+// of their type, enterprise credentials are kept between attempts like on the device.
+// Station events are sent by advance() when the replayed status changes, with the SDK reason code
+// of the new status. A drop and an SDK reconnect are status records after WL_CONNECTED.
+// Time is virtual, host millis() and micros() are expected to return now() and now() * 1000
+
+namespace justwifi {
+namespace replay {
+
+// Inputs are not copied and must outlive the replay. Resets the clock
+void load(const justwifi_input_t* inputs, size_t size);
+
+uint32_t now();
+void advance(uint32_t ms);
+
+// Calls instance.loop() every 'step' ms of virtual time, until connected or 'limit' ms have passed.
+// Returns the time it took to connect, 0 when it did not
+uint32_t run(JustWifi& instance, uint32_t step, uint32_t limit);
+
+// Time in ms the radio spent away from 'channel' since load(), scans included. ESP-NOW peers
+// on that channel lose packets during these windows, 'longest' receives the longest one
+uint32_t away(uint8_t channel, uint32_t* longest = nullptr);
+
+// Heap allocations counter of the host, e.g. a malloc() replacement. Reported by backend::allocations()
+// and so by the profiling counters. Without one they stay at 0
+using allocations_type = uint32_t(*)();
+void setAllocations(allocations_type counter);
+
+// Backend without single channel scans (like ESP32 Arduino core 1.x), scans always sweep. On by default
+void setSingleChannel(bool supported);
+
+// SoftAP clients, reported by softAPStations() while the AP is up. After every AP restart they
+// need 'rejoin' ms to associate again
+void setStations(uint8_t count, uint32_t rejoin);
+
+// Time in ms those clients could not be served since the AP was first started: AP stopped or
+// restarting, or the radio away from the AP channel. 'longest' receives the longest outage
+uint32_t downtime(uint32_t* longest = nullptr);
+
+} // namespace replay
+} // namespace justwifi
+
+#endif
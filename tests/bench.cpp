@@ -0,0 +1,104 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Profiling counters over network list and scan sizes, one JSON object per point and size:
+//   make -C tests bench > bench.jsonl
+// Cycles are host time as 80 MHz cycles, allocations are counted by host/alloc.cpp
+
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+// Known networks are the first results, the strongest one is joined
+void session(size_t networks, size_t results) {
+
+    std::vector<std::string> ssids;
+    for (size_t index = 0; index < std::max(networks, results); ++index) {
+        // Longer than the short string buffer, so every copy is a heap allocation like on the device
+        ssids.push_back("benchmark-network-" + std::to_string(index));
+    }
+
+    test::Capture capture;
+    capture.add(INPUT_SCAN, 2000, results);
+    for (size_t index = 0; index < results; ++index) {
+        capture.add(INPUT_SCAN_RESULT, 0, index, ssids[index].c_str(), -40 - (index % 50), 1 + (index % 11));
+    }
+    capture
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, ssids[0].c_str(), -40, 1)
+        .add(INPUT_STATUS, 500, WL_CONNECTED);
+
+    // Whole list in one command, more than the queue holds otherwise
+    std::vector<justwifi_network_config_t> configs;
+    for (size_t index = 0; index < networks; ++index) {
+        justwifi_network_config_t config {};
+        config.ssid = ssids[index].c_str();
+        config.pass = "password";
+        configs.push_back(config);
+    }
+
+    jw.cleanNetworks();
+    jw.loop();
+
+    jw.profileReset();
+    jw.applyNetworks(configs.data(), configs.size());
+    jw.enableSTA(true);
+    jw.loop();
+
+    capture.load();
+    justwifi::replay::run(jw, 10, 30000);
+    steps(1000);
+
+    jw.profileDump(Serial);
+
+    jw.enableSTA(false);
+    jw.disconnect();
+    jw.loop();
+
+}
+
+} // namespace
+
+int main() {
+
+    justwifi::replay::setAllocations(host::allocations);
+
+    jw.begin();
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+
+    for (size_t networks : { 1, 8, 32, 64 }) {
+        for (size_t results : { 8, 32, 100 }) {
+            session(networks, results);
+        }
+    }
+
+    return 0;
+
+}
@@ -0,0 +1,71 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Loop budget used up by a single micros() call: work is deferred, but every loop() still moves on
+
+#include "test.h"
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 1000, 5)
+        .add(INPUT_SCAN_RESULT, 0, 0, "first", -50, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "second", -55, 1)
+        .add(INPUT_SCAN_RESULT, 0, 2, "third", -55, 6)
+        .add(INPUT_SCAN_RESULT, 0, 3, "home", -60, 6)
+        .add(INPUT_SCAN_RESULT, 0, 4, "fourth", -70, 11)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 500, WL_CONNECTED)
+        .add(INPUT_RESOLVE, 0, 1, "one.example.com")
+        .add(INPUT_RESOLVE, 0, 1, "two.example.com");
+
+    static const char* const hosts[] { "one.example.com", "two.example.com" };
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+    jw.setWarmup(hosts, 2);
+    jw.addNetwork("home", "password");
+    jw.loop();
+
+    host::micros_step = 100;
+    jw.setLoopBudget(100);
+    capture.load();
+    test::messages().clear();
+
+    for (int step = 0; (step < 1000) && !test::count(test::messages(), MESSAGE_NETWORK_READY); ++step) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+
+    CHECK(jw.connected());
+    CHECK_EQUAL(1, test::count(test::messages(), MESSAGE_CONNECTED));
+    CHECK_EQUAL(1, test::count(test::messages(), MESSAGE_NETWORK_READY));
+    CHECK_EQUAL(1, jw.getNetwork(0).stats().successes);
+
+    host::micros_step = 0;
+    jw.setLoopBudget(0);
+
+    return test::result("budget");
+
+}
@@ -0,0 +1,85 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Duty cycle leaves the radio on after the send hook, so the packets it queued go out before deep sleep.
+// Its timeout counts from startCycle(), however long after boot that is
+
+#include "test.h"
+
+namespace {
+
+unsigned long sent_at = 0;
+unsigned long sleep_at = 0;
+
+void send() {
+    sent_at = millis();
+}
+
+void onSleep(justwifi_messages_t message, char*) {
+    if (MESSAGE_CYCLE_SLEEP == message) sleep_at = millis();
+}
+
+void steps(int count) {
+    for (int step = 0; step < count; ++step) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 1000, 1)
+        .add(INPUT_SCAN_RESULT, 0, 0, "home", -60, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 500, WL_CONNECTED);
+    capture.load();
+
+    // Cycle timeout counts from startCycle(), not from boot
+    justwifi::replay::advance(JUSTWIFI_CYCLE_TIMEOUT * 2);
+
+    jw.begin();
+    jw.subscribe(onSleep);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+    jw.addNetwork("home", "password");
+    jw.startCycle(send, 1000000ull);
+
+    for (int step = 0; (step < 1000) && !sleep_at; ++step) {
+        steps(1);
+    }
+
+    CHECK(sent_at > 0);
+    CHECK(sleep_at > 0);
+    CHECK(sleep_at - sent_at >= JUSTWIFI_CYCLE_FLUSH);
+    CHECK(sleep_at - sent_at < JUSTWIFI_CYCLE_FLUSH + 50);
+
+    const auto& last = jw.getLastCycle();
+    CHECK(last.sent);
+    CHECK_EQUAL(sent_at, last.ready);
+    CHECK(last.awake >= sleep_at);
+
+    return test::result("cycle");
+
+}
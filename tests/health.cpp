@@ -0,0 +1,108 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Gateway stops answering: after the configured misses the next network is tried, and when that
+// one fails too the list starts over after the reconnect timeout
+
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+std::vector<std::string> disconnected;
+
+void onDisconnected(justwifi_messages_t message, char* parameter) {
+    if (MESSAGE_DISCONNECTED == message) disconnected.push_back(parameter);
+}
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 200, WL_CONNECTED)
+        .add(INPUT_PROBE, 20, 1)
+        .add(INPUT_PROBE, 1000, 0)
+        .add(INPUT_PROBE, 1000, 0)
+        .add(INPUT_PROBE, 1000, 0)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "work", -70, 11)
+        .add(INPUT_STATUS, 300, WL_CONNECT_FAILED);
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.subscribe(onDisconnected);
+    jw.enableAPFallback(false);
+    jw.enableScan(false);
+    jw.setConnectTimeout(3000);
+    jw.setReconnectTimeout(10000);
+    jw.setHealthCheck(5000, 3);
+    jw.addNetwork("home", "password");
+    jw.addNetwork("work", "password");
+    capture.load();
+
+    CHECK(justwifi::replay::run(jw, 10, 1000) > 0);
+    test::messages().clear();
+
+    // One answered probe, three lost ones
+    steps(25000);
+    CHECK(!jw.connected());
+
+    const auto& home = jw.getNetwork(0).stats();
+    CHECK_EQUAL(4, home.probes);
+    CHECK_EQUAL(3, home.lost);
+    CHECK_EQUAL(1, home.unreachable);
+    CHECK_EQUAL(20, home.rtt);
+    CHECK_EQUAL(0, home.disconnects);     // we left, the link did not drop
+
+    const auto& work = jw.getNetwork(1).stats();
+    CHECK_EQUAL(1, work.attempts);
+    CHECK_EQUAL(0, work.successes);
+
+    const std::vector<uint8_t> failover {
+        MESSAGE_GATEWAY_UNREACHABLE, MESSAGE_DISCONNECTED,
+        MESSAGE_CONNECTING, MESSAGE_CONNECT_FAILED
+    };
+    CHECK(failover == test::messages());
+
+    // Subscribers parse it like the SDK disconnections
+    CHECK_EQUAL(1, disconnected.size());
+    CHECK(!disconnected.empty() && (disconnected.front() == "REASON: 255, SSID: home"));
+
+    // Nothing left to try until the reconnect timeout, then home again
+    test::messages().clear();
+    steps(10000);
+    CHECK(jw.connected());
+    CHECK_EQUAL(2, home.successes);
+    CHECK_EQUAL(1, test::count(test::messages(), MESSAGE_CONNECTED));
+
+    return test::result("health");
+
+}
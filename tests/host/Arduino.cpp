@@ -0,0 +1,53 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#include <Arduino.h>
+#include <JustWifiReplay.h>
+
+HostSerial Serial;
+
+namespace host {
+
+unsigned long micros_step = 0;
+
+namespace {
+
+unsigned long _micros = 0;
+
+} // namespace
+
+} // namespace host
+
+unsigned long millis() {
+    return justwifi::replay::now();
+}
+
+unsigned long micros() {
+    host::_micros += host::micros_step;
+    return justwifi::replay::now() * 1000ul + host::_micros;
+}
+
+void delay(unsigned long ms) {
+    justwifi::replay::advance(ms);
+}
+
+void yield() {
+}
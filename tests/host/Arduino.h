@@ -0,0 +1,133 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// The part of the Arduino API JustWifi uses, for host builds with -DJUSTWIFI_BACKEND_REPLAY.
+// Time follows the replay clock, see Arduino.cpp
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define PSTR(s) (s)
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+
+namespace host {
+
+// Every micros() call moves the clock forward by this many µs, so loop budgets can be exercised
+extern unsigned long micros_step;
+
+// Heap allocations so far, defined by alloc.cpp when it is linked in (benchmark only)
+uint32_t allocations();
+
+} // namespace host
+
+class String {
+
+    public:
+
+        String() = default;
+        String(const char* value) : _value(value ? value : "") {}
+
+        const char* c_str() const { return _value.c_str(); }
+        size_t length() const { return _value.size(); }
+        bool equals(const char* other) const { return other && (_value == other); }
+
+    private:
+
+        std::string _value;
+
+};
+
+class IPAddress {
+
+    public:
+
+        IPAddress() = default;
+        IPAddress(uint32_t address) : _address(address) {}
+        IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) :
+            _address(a | (b << 8) | (c << 16) | (static_cast<uint32_t>(d) << 24))
+        {}
+
+        bool fromString(const char* address) {
+            unsigned a, b, c, d;
+            if (4 != sscanf(address, "%u.%u.%u.%u", &a, &b, &c, &d)) return false;
+            *this = IPAddress(a, b, c, d);
+            return true;
+        }
+
+        operator uint32_t() const { return _address; }
+
+    private:
+
+        uint32_t _address { 0u };
+
+};
+
+class Print {
+
+    public:
+
+        virtual ~Print() = default;
+        virtual size_t write(const uint8_t* data, size_t size) = 0;
+
+        size_t print(const char* value) {
+            return write(reinterpret_cast<const uint8_t*>(value), strlen(value));
+        }
+
+        size_t println(const char* value) {
+            return print(value) + print("\n");
+        }
+
+        size_t printf(const char* format, ...) {
+            char buffer[256];
+            va_list args;
+            va_start(args, format);
+            vsnprintf(buffer, sizeof(buffer), format, args);
+            va_end(args);
+            return print(buffer);
+        }
+
+};
+
+// stdout
+class HostSerial : public Print {
+    public:
+        size_t write(const uint8_t* data, size_t size) override {
+            return fwrite(data, 1, size, stdout);
+        }
+};
+
+extern HostSerial Serial;
+
+#endif
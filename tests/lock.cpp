@@ -0,0 +1,106 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Channel lock for ESP-NOW peers: the strongest network is on another channel and is never joined,
+// the radio only visits the locked channels, and moving to another one of them is announced
+
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+std::vector<std::string> changes;
+
+void onChange(justwifi_messages_t message, char* parameter) {
+    if (MESSAGE_CHANNEL_CHANGE == message) changes.push_back(parameter);
+}
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+// Time spent on neither of the two channels
+uint32_t outside(uint8_t first, uint8_t second) {
+    return justwifi::replay::away(first) + justwifi::replay::away(second) - justwifi::replay::now();
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 100, 3)
+        .add(INPUT_SCAN_RESULT, 0, 0, "home", -50, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "work", -70, 6)
+        .add(INPUT_SCAN_RESULT, 0, 2, "other", -75, 11)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "work", -70, 6)
+        .add(INPUT_STATUS, 300, WL_CONNECTED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "other", -75, 11)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.subscribe(onChange);
+    jw.enableAPFallback(false);
+    jw.addNetwork("home", "password");
+    jw.addNetwork("work", "password");
+    jw.addNetwork("other", "password");
+    jw.setChannelLock(JUSTWIFI_CHANNEL(6) | JUSTWIFI_CHANNEL(11));
+    capture.load();
+
+    CHECK(justwifi::replay::run(jw, 10, 5000) > 0);
+    CHECK_EQUAL(0, jw.getNetwork(0).stats().attempts);
+    CHECK_EQUAL(1, jw.getNetwork(1).stats().successes);
+    CHECK(outside(6, 11) <= 50);    // not tuned yet before the first scan
+
+    // Channel 6 is dropped from the set, the move to 11 is announced before leaving
+    changes.clear();
+    jw.setChannelLock(JUSTWIFI_CHANNEL(11));
+    steps(2000);
+    CHECK(jw.connected());
+    CHECK_EQUAL(1, jw.getNetwork(2).stats().successes);
+    CHECK(!changes.empty());
+    for (const auto& change : changes) {
+        CHECK(change == "CH: 6 -> 11");
+    }
+
+    // ESP32 core 1.x sweeps every channel, results outside of the lock are still ignored
+    justwifi::replay::setSingleChannel(false);
+    capture.load();
+    test::messages().clear();
+    jw.resetScanStats();
+    jw.setChannelLock(JUSTWIFI_CHANNEL(6) | JUSTWIFI_CHANNEL(11));
+    jw.disconnect();
+    CHECK(justwifi::replay::run(jw, 10, 5000) > 0);
+    CHECK_EQUAL(0, jw.getNetwork(0).stats().attempts);
+    CHECK(!jw.getNetwork(0).scanned());
+    CHECK_EQUAL(0, jw.getScanStats().slices);
+    CHECK_EQUAL(2 * test::count(test::messages(), MESSAGE_SCANNING), test::count(test::messages(), MESSAGE_FOUND_NETWORK));
+    CHECK_EQUAL(2, jw.getNetwork(2).stats().successes);     // last one used wins
+
+    return test::result("lock");
+
+}
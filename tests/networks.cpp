@@ -0,0 +1,177 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Networks list changes while the state machine is using it
+
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+void steps(int count) {
+    for (int step = 0; step < count; ++step) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+// Cleaning the list in the middle of an attempt starts over, instead of walking the old candidates
+void cleanWhileConnecting() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 1000, 1)
+        .add(INPUT_SCAN_RESULT, 0, 0, "home", -60, 1)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 1);
+    capture.load();
+
+    jw.addNetwork("home", "password");
+    for (int step = 0; (step < 500) && !jw.getCandidateNetwork(); ++step) {
+        steps(1);
+    }
+    CHECK(jw.getCandidateNetwork());
+
+    jw.cleanNetworks();
+    steps(100);
+    CHECK_EQUAL(0, jw.networks().size());
+    CHECK(!jw.getCandidateNetwork());
+
+    // And the next network is tried as usual
+    jw.addNetwork("home", "password");
+    for (int step = 0; (step < 500) && !jw.getCandidateNetwork(); ++step) {
+        steps(1);
+    }
+    CHECK(jw.getCandidateNetwork());
+    steps(2);
+    CHECK_EQUAL(1, jw.getNetwork(0).stats().attempts);
+
+    jw.cleanNetworks();
+    steps(1);
+    justwifi::replay::load(nullptr, 0);
+
+}
+
+// Whole list goes through the queue as one command, however long it is
+void applyMany() {
+
+    std::vector<std::string> names;
+    for (int index = 0; index < 40; ++index) {
+        names.push_back("network" + std::to_string(index));
+    }
+
+    std::vector<justwifi_network_config_t> configs;
+    for (const auto& name : names) {
+        justwifi_network_config_t config {};
+        config.ssid = name.c_str();
+        config.pass = "password";
+        configs.push_back(config);
+    }
+
+    CHECK(jw.applyNetworks(configs.data(), configs.size()));
+    steps(1);
+    CHECK_EQUAL(40, jw.networks().size());
+
+    // Unchanged networks keep their strings, the ones left out are removed
+    const char* kept = jw.getNetwork(10).ssid();
+    configs.resize(20);
+    configs[10].pass = "secret";
+    configs[11].pass = nullptr;
+    CHECK(jw.applyNetworks(configs.data(), configs.size()));
+    steps(1);
+    CHECK_EQUAL(20, jw.networks().size());
+    CHECK(kept == jw.getNetwork(10).ssid());
+    CHECK(jw.getNetwork(10).secured());
+    CHECK(!jw.getNetwork(11).secured());
+
+    // Invalid entry rejects the whole set
+    configs[5].ssid = "";
+    CHECK(!jw.applyNetworks(configs.data(), configs.size()));
+    steps(1);
+    CHECK_EQUAL(20, jw.networks().size());
+
+    jw.cleanNetworks();
+    steps(1);
+
+}
+
+// Ids are uint8_t with 0xFF as none, the list stops at JUSTWIFI_NETWORKS_MAX
+void limit() {
+
+    std::vector<std::string> names;
+    for (size_t index = 0; index <= JUSTWIFI_NETWORKS_MAX; ++index) {
+        names.push_back("network" + std::to_string(index));
+    }
+
+    std::vector<justwifi_network_config_t> configs;
+    for (const auto& name : names) {
+        justwifi_network_config_t config {};
+        config.ssid = name.c_str();
+        configs.push_back(config);
+    }
+
+    CHECK(!jw.applyNetworks(configs.data(), configs.size()));
+    configs.pop_back();
+    CHECK(jw.applyNetworks(configs.data(), configs.size()));
+    steps(1);
+    CHECK_EQUAL(JUSTWIFI_NETWORKS_MAX, jw.networks().size());
+
+    CHECK(jw.addNetwork(names.back().c_str(), nullptr));
+    steps(1);
+    CHECK_EQUAL(JUSTWIFI_NETWORKS_MAX, jw.networks().size());
+
+    size_t count = 0;
+    for (auto network : jw.networks()) {
+        CHECK(names[count] == network.ssid());
+        ++count;
+    }
+    CHECK_EQUAL(JUSTWIFI_NETWORKS_MAX, count);
+
+    // Networks left out make room for the new ones
+    configs.erase(configs.begin());
+    configs.push_back(justwifi_network_config_t {});
+    configs.back().ssid = names.back().c_str();
+    CHECK(jw.applyNetworks(configs.data(), configs.size()));
+    steps(1);
+    CHECK_EQUAL(JUSTWIFI_NETWORKS_MAX, jw.networks().size());
+    CHECK(names.back() == jw.getNetwork(JUSTWIFI_NETWORKS_MAX - 1).ssid());
+
+    jw.cleanNetworks();
+    steps(1);
+
+}
+
+} // namespace
+
+int main() {
+
+    jw.begin();
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+    jw.setConnectTimeout(60000);
+
+    cleanWhileConnecting();
+    applyMany();
+    limit();
+
+    return test::result("networks");
+
+}
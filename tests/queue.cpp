@@ -0,0 +1,108 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// API calls from several threads while another one runs loop(), see JustWifiQueue.h
+
+#include "test.h"
+
+#include <atomic>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace {
+
+constexpr int Threads = 4;
+constexpr int Networks = 50;
+
+int added = 0;
+int locks = 0;
+
+void onDone(justwifi_messages_t message, char* name) {
+    if (MESSAGE_COMMAND_DONE != message) return;
+    if (0 == strcmp(name, "ADD_NETWORK")) ++added;
+    if (0 == strcmp(name, "LOCK_CHANNELS")) ++locks;
+}
+
+// Retries while the queue is full, every call has to make it in the end
+void producer(int thread, std::atomic<int>& finished) {
+    for (int index = 0; index < Networks; ++index) {
+        std::string ssid = "thread" + std::to_string(thread) + "-" + std::to_string(index);
+        while (!jw.addNetwork(ssid.c_str(), "password")) {
+            std::this_thread::yield();
+        }
+        while (!jw.setChannelLock(0)) {
+            std::this_thread::yield();
+        }
+    }
+    ++finished;
+}
+
+} // namespace
+
+int main() {
+
+    jw.begin();
+    jw.subscribe(onDone);
+    jw.enableSTA(false);
+
+    // Before the first loop() there is no queue to fill up
+    for (int index = 0; index < 2 * JUSTWIFI_COMMAND_QUEUE_SIZE; ++index) {
+        std::string ssid = "setup" + std::to_string(index);
+        CHECK(jw.addNetwork(ssid.c_str(), "password"));
+    }
+    CHECK_EQUAL(2 * JUSTWIFI_COMMAND_QUEUE_SIZE, jw.networks().size());
+    CHECK(jw.cleanNetworks());
+    jw.loop();
+
+    added = 0;
+    std::atomic<int> finished { 0 };
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < Threads; ++thread) {
+        threads.emplace_back(producer, thread, std::ref(finished));
+    }
+
+    while ((finished < Threads) || (added < Threads * Networks) || (locks < Threads * Networks)) {
+        justwifi::replay::advance(1);
+        jw.loop();
+    }
+
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // Nothing lost or applied twice
+    CHECK_EQUAL(Threads * Networks, added);
+    CHECK_EQUAL(Threads * Networks, locks);
+    CHECK_EQUAL(Threads * Networks, jw.networks().size());
+
+    std::set<std::string> ssids;
+    for (const auto& network : jw.networks()) {
+        ssids.insert(network.ssid());
+    }
+    CHECK_EQUAL(Threads * Networks, ssids.size());
+
+    jw.cleanNetworks();
+    jw.loop();
+
+    return test::result("queue");
+
+}
@@ -0,0 +1,134 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Session captured on the device: the strongest known network times out, the next one connects.
+// Replaying it has to go through the same states, and record the same inputs again
+
+#include "test.h"
+
+namespace {
+
+std::vector<justwifi_input_t> recorded;
+
+void record(const justwifi_input_t& input) {
+    recorded.push_back(input);
+}
+
+struct Session {
+    uint32_t time;
+    std::vector<uint8_t> states;
+    std::vector<uint8_t> messages;
+};
+
+// Runs until connected and settled, then stops the station so the next one starts from scratch
+Session session(const justwifi_input_t* inputs, size_t size) {
+
+    jw.cleanNetworks();
+    jw.addNetwork("home", "password");
+    jw.addNetwork("work", "password");
+    jw.enableSTA(true);
+    jw.loop();
+
+    justwifi::replay::load(inputs, size);
+    jw.traceClear();
+    test::messages().clear();
+    recorded.clear();
+
+    Session result;
+    result.time = justwifi::replay::run(jw, 10, 30000);
+    for (int step = 0; step < 10; ++step) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+    result.states = test::states(jw);
+    result.messages = test::messages();
+
+    jw.enableSTA(false);
+    jw.disconnect();
+    jw.loop();
+
+    return result;
+
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 2100, 3)
+        .add(INPUT_SCAN_RESULT, 0, 0, "other", -50, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "home", -60, 6)
+        .add(INPUT_SCAN_RESULT, 0, 2, "work", -75, 11)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 3200, WL_NO_SSID_AVAIL)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "work", -75, 11)
+        .add(INPUT_STATUS, 1400, WL_CONNECTED);
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.setRecorder(record);
+    jw.setConnectTimeout(5000);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+
+    auto first = session(capture.inputs.data(), capture.inputs.size());
+    CHECK(first.time > 0);
+    CHECK_EQUAL(1, jw.getNetwork(0).stats().attempts);
+    CHECK_EQUAL(0, jw.getNetwork(0).stats().successes);
+    CHECK_EQUAL(1, jw.getNetwork(1).stats().attempts);
+    CHECK_EQUAL(1, jw.getNetwork(1).stats().successes);
+
+    const std::vector<uint8_t> states {
+        STATE_SCAN_START, STATE_SCAN_ONGOING,
+        STATE_STA_START, STATE_STA_ONGOING,
+        STATE_STA_START, STATE_STA_ONGOING,
+        STATE_STA_SUCCESS, STATE_IDLE
+    };
+    CHECK(states == first.states);
+
+    const std::vector<uint8_t> messages {
+        MESSAGE_SCANNING, MESSAGE_FOUND_NETWORK, MESSAGE_FOUND_NETWORK, MESSAGE_FOUND_NETWORK,
+        MESSAGE_CONNECTING, MESSAGE_CONNECT_FAILED,
+        MESSAGE_CONNECTING, MESSAGE_CONNECTED
+    };
+    CHECK(messages == first.messages);
+
+    // Recording of the replay is the capture itself, times and all
+    auto again = recorded;
+    CHECK_EQUAL(capture.inputs.size(), again.size());
+    for (size_t index = 0; index < std::min(again.size(), capture.inputs.size()); ++index) {
+        CHECK_EQUAL(capture.inputs[index].type, again[index].type);
+        CHECK_EQUAL(capture.inputs[index].value, again[index].value);
+        CHECK_EQUAL(capture.inputs[index].time, again[index].time);
+        CHECK(0 == strcmp(capture.inputs[index].ssid, again[index].ssid));
+    }
+
+    // And replaying that recording gives the same session
+    auto second = session(again.data(), again.size());
+    CHECK_EQUAL(first.time, second.time);
+    CHECK(states == second.states);
+    CHECK(messages == second.messages);
+
+    return test::result("replay");
+
+}
@@ -0,0 +1,179 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+
+// RSSI filter over replayed scans: a single fade does not reorder two close networks,
+// and a network missing from the scan stays a candidate for JUSTWIFI_RSSI_MISSES scans
+
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+std::vector<std::string> attempts;
+
+void record(const justwifi_input_t& input) {
+    if (INPUT_CONNECT == input.type) attempts.push_back(input.ssid);
+}
+
+void steps(int count) {
+    for (int step = 0; step < count; ++step) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+// Filtered RSSI only, attempt history and the sticky bonus would hide what is tested
+int32_t filtered(const network_t& network, bool) {
+    return network.rssi * 10;
+}
+
+// Connects from scratch over the given capture, returns the networks tried in order
+std::vector<std::string> session(test::Capture& capture) {
+
+    attempts.clear();
+    jw.enableSTA(true);
+    jw.loop();
+
+    capture.load();
+    justwifi::replay::run(jw, 10, 30000);
+    steps(10);
+
+    jw.enableSTA(false);
+    jw.disconnect();
+    jw.loop();
+
+    return attempts;
+
+}
+
+// 'near' is 2 dB stronger than 'far' on every scan but one, where it fades by 6 dB
+void fade() {
+
+    test::Capture steady;
+    steady
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "near", -60, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "far", -62, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "near", -60, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    test::Capture faded;
+    faded
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "near", -66, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "far", -62, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "near", -66, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "far", -62, 6)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    jw.cleanNetworks();
+    jw.addNetwork("near", "password");
+    jw.addNetwork("far", "password");
+    jw.loop();
+
+    const std::vector<std::string> near { "near" };
+    CHECK(near == session(steady));
+    CHECK(near == session(steady));
+
+    // Faded sample is only 30% of the average
+    CHECK(near == session(faded));
+    CHECK_EQUAL(-66, jw.getNetwork(0).lastRSSI());
+    CHECK(jw.getNetwork(0).rssi() > jw.getNetwork(1).rssi());
+    CHECK(near == session(steady));
+
+    // Ranked on the last scan only, the fade wins
+    jw.setRSSIFilter(100);
+    const std::vector<std::string> far { "far" };
+    CHECK(far == session(faded));
+    jw.setRSSIFilter(JUSTWIFI_RSSI_WEIGHT);
+
+}
+
+// 'near' is missing from the scans, 'far' refuses the connection so the fallback shows
+void missed() {
+
+    test::Capture both;
+    both
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "near", -60, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "far", -62, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "near", -60, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    test::Capture alone;
+    alone
+        .add(INPUT_SCAN, 1000, 1)
+        .add(INPUT_SCAN_RESULT, 0, 0, "far", -62, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "far", -62, 6)
+        .add(INPUT_STATUS, 300, WL_CONNECT_FAILED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "near", -60, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    jw.cleanNetworks();
+    jw.addNetwork("near", "password");
+    jw.addNetwork("far", "password");
+    jw.loop();
+
+    const std::vector<std::string> near { "near" };
+    CHECK(near == session(both));
+
+    // Kept with a penalty, now below 'far' but still tried after it
+    const std::vector<std::string> fallback { "far", "near" };
+    for (uint8_t miss = 1; miss <= JUSTWIFI_RSSI_MISSES; ++miss) {
+        CHECK(fallback == session(alone));
+        CHECK_EQUAL(miss, jw.getNetwork(0).missed());
+        CHECK(!jw.getNetwork(0).scanned());
+        CHECK(jw.getNetwork(0).rssi() != 0);
+    }
+
+    // One miss too many, no longer a candidate
+    const std::vector<std::string> dropped { "far" };
+    CHECK(dropped == session(alone));
+    CHECK_EQUAL(0, jw.getNetwork(0).rssi());
+
+    // Back in the scan, back to first
+    CHECK(near == session(both));
+    CHECK_EQUAL(0, jw.getNetwork(0).missed());
+
+}
+
+} // namespace
+
+int main() {
+
+    jw.begin();
+    jw.setConnectTimeout(5000);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+    jw.setRecorder(record);
+    jw.setScoring(filtered);
+    jw.enableSTA(false);
+    jw.loop();
+
+    fade();
+    missed();
+
+    return test::result("rssi");
+
+}
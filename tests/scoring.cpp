@@ -0,0 +1,226 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Candidate ranking over replayed scans: attempt history, join time, security and sticky bonus,
+// and a custom scorer replacing defaultScore()
+
+#include "test.h"
+
+#include <string>
+
+namespace {
+
+std::vector<std::string> attempts;
+
+void record(const justwifi_input_t& input) {
+    if (INPUT_CONNECT == input.type) attempts.push_back(input.ssid);
+}
+
+void steps(int count) {
+    for (int step = 0; step < count; ++step) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+// Connects from scratch over the given capture, returns the networks tried in order
+std::vector<std::string> session(test::Capture& capture) {
+
+    attempts.clear();
+    jw.enableSTA(true);
+    jw.loop();
+
+    capture.load();
+    justwifi::replay::run(jw, 10, 30000);
+    steps(10);
+
+    jw.enableSTA(false);
+    jw.disconnect();
+    jw.loop();
+
+    return attempts;
+
+}
+
+// Score differences are in 0.1 dB
+void defaults() {
+
+    network_t network {};
+    network.rssi = -60;
+    network.security = ENC_TYPE_NONE;
+    const int32_t open = JustWifi::defaultScore(network, false);
+    CHECK_EQUAL(-600, open);
+
+    network.security = ENC_TYPE_TKIP;
+    CHECK_EQUAL(open + 10, JustWifi::defaultScore(network, false));
+    network.security = ENC_TYPE_CCMP;
+    CHECK_EQUAL(open + 20, JustWifi::defaultScore(network, false));
+    CHECK_EQUAL(open + 70, JustWifi::defaultScore(network, true));
+
+    // Half of the recent attempts failed, and joining takes 3 s on average
+    network.security = ENC_TYPE_NONE;
+    network.stats.history = 0b0101;
+    network.stats.history_size = 4;
+    network.stats.joins = 2;
+    network.stats.join_time = 6000;
+    CHECK_EQUAL(open - 100 - 30, JustWifi::defaultScore(network, false));
+
+}
+
+// 12 dB stronger, but it never lets us in
+void failing() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "strong", -48, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "reliable", -60, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "strong", -48, 1)
+        .add(INPUT_STATUS, 500, WL_CONNECT_FAILED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "reliable", -60, 6)
+        .add(INPUT_STATUS, 800, WL_CONNECTED);
+
+    jw.cleanNetworks();
+    jw.addNetwork("strong", "password");
+    jw.addNetwork("reliable", "password");
+    jw.loop();
+
+    const std::vector<std::string> first { "strong", "reliable" };
+    CHECK(first == session(capture));
+
+    // Reliable one goes first from now on, the strong one is still the fallback
+    const std::vector<std::string> next { "reliable" };
+    for (int wake = 0; wake < 3; ++wake) {
+        CHECK(next == session(capture));
+    }
+    CHECK(jw.getNetwork(0).score() < jw.getNetwork(1).score());
+    CHECK_EQUAL(1, jw.getNetwork(0).stats().attempts);
+
+}
+
+// Network we were connected to stays first until another one is clearly better
+void sticky() {
+
+    test::Capture alone;
+    alone
+        .add(INPUT_SCAN, 1000, 1)
+        .add(INPUT_SCAN_RESULT, 0, 0, "current", -60, 1)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "current", -60, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    test::Capture close;
+    close
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "current", -60, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "other", -57, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "current", -60, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "other", -57, 6)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    test::Capture better;
+    better
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "current", -60, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "other", -50, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "current", -60, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "other", -50, 6)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    jw.cleanNetworks();
+    jw.addNetwork("current", "password");
+    jw.addNetwork("other", "password");
+    jw.setRSSIFilter(100);
+    jw.loop();
+
+    const std::vector<std::string> current { "current" };
+    CHECK(current == session(alone));
+
+    // 3 dB is within the 5 dB bonus, again and again
+    for (int wake = 0; wake < 3; ++wake) {
+        CHECK(current == session(close));
+    }
+
+    // 10 dB is not
+    const std::vector<std::string> other { "other" };
+    CHECK(other == session(better));
+
+    jw.setRSSIFilter(JUSTWIFI_RSSI_WEIGHT);
+    jw.loop();
+
+}
+
+// Weakest first, then back to the default
+int32_t weakest(const network_t& network, bool) {
+    return -network.rssi;
+}
+
+void custom() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 1000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "near", -45, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "far", -75, 6)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "near", -45, 1)
+        .add(INPUT_STATUS, 300, WL_CONNECTED)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "far", -75, 6)
+        .add(INPUT_STATUS, 300, WL_CONNECTED);
+
+    jw.cleanNetworks();
+    jw.addNetwork("near", "password");
+    jw.addNetwork("far", "password");
+    jw.setScoring(weakest);
+    jw.loop();
+
+    const std::vector<std::string> reversed { "far" };
+    CHECK(reversed == session(capture));
+
+    // Sticky bonus belongs to defaultScore(), 30 dB is more than it anyway
+    jw.setScoring(nullptr);
+    jw.loop();
+
+    const std::vector<std::string> ranked { "near" };
+    CHECK(ranked == session(capture));
+
+}
+
+} // namespace
+
+int main() {
+
+    jw.begin();
+    jw.setRecorder(record);
+    jw.setConnectTimeout(5000);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+    jw.enableSTA(false);
+    jw.loop();
+
+    defaults();
+    failing();
+    sticky();
+    custom();
+
+    return test::result("scoring");
+
+}
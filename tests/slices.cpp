@@ -0,0 +1,77 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Sliced scans against a capture with every channel in each scan, like the SDK returns when it
+// ignores the channel. Each result is counted once per sweep, and without single channel scans
+// slicing is turned off instead of sweeping every channel on every slice
+
+#include "test.h"
+
+namespace {
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 100, 3)
+        .add(INPUT_SCAN_RESULT, 0, 0, "home", -60, 6)
+        .add(INPUT_SCAN_RESULT, 0, 1, "other", -80, 6)
+        .add(INPUT_SCAN_RESULT, 0, 2, "far", -70, 11);
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.enableAPFallback(false);
+    jw.enableScan(true);
+    jw.setScanSlices(3, 0, 100);
+    jw.setConnectTimeout(500);
+    jw.addNetwork("home", "password");
+    capture.load();
+
+    steps(3000);
+    CHECK(jw.getScanStats().sweeps > 0);
+    CHECK(jw.getScanStats().slices >= (JUSTWIFI_CHANNELS + 2) / 3);
+    CHECK_EQUAL(3 * jw.getScanStats().sweeps, test::count(test::messages(), MESSAGE_FOUND_NETWORK));
+    CHECK_EQUAL(-60, jw.getNetwork(0).rssi());
+
+    // ESP32 core 1.x: whole sweeps, one scan each
+    justwifi::replay::setSingleChannel(false);
+    jw.resetScanStats();
+    capture.load();
+    test::messages().clear();
+    jw.disconnect();
+    steps(1000);
+
+    CHECK_EQUAL(0, jw.getScanStats().slices);
+    CHECK(test::count(test::messages(), MESSAGE_SCANNING) > 0);
+    CHECK_EQUAL(3 * test::count(test::messages(), MESSAGE_SCANNING), test::count(test::messages(), MESSAGE_FOUND_NETWORK));
+
+    return test::result("slices");
+
+}
@@ -0,0 +1,103 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// SoftAP with a client while the station keeps failing: with coexistence only the scans take the
+// radio away from the AP channel, without it every attempt on another channel does too
+
+#include "test.h"
+
+namespace {
+
+constexpr uint32_t Rejoin = 3000;
+
+std::vector<uint8_t> seen;
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+uint32_t outage(test::Capture& capture, bool coexistence, uint32_t& longest) {
+
+    capture.load();
+    justwifi::replay::setStations(1, Rejoin);
+    jw.enableAPCoexistence(coexistence);
+    jw.enableAP(true);
+    jw.addNetwork("home", "password");
+    jw.addNetwork("work", "password");
+    jw.enableSTA(true);
+    steps(60000);
+
+    uint32_t result = justwifi::replay::downtime(&longest);
+    seen = test::messages();
+
+    jw.enableSTA(false);
+    jw.enableAP(false);
+    jw.cleanNetworks();
+    jw.disconnect();
+    steps(100);
+
+    return result;
+
+}
+
+} // namespace
+
+int main() {
+
+    // AP starts on channel 1, the stronger network is on another channel
+    test::Capture capture;
+    capture
+        .add(INPUT_SCAN, 2000, 2)
+        .add(INPUT_SCAN_RESULT, 0, 0, "home", -70, 1)
+        .add(INPUT_SCAN_RESULT, 0, 1, "work", -50, 11)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "work", -50, 11)
+        .add(INPUT_STATUS, 1500, WL_NO_SSID_AVAIL)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -70, 1)
+        .add(INPUT_STATUS, 1500, WL_NO_SSID_AVAIL);
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.enableScan(true);
+    jw.enableAPFallback(true);
+    jw.setConnectTimeout(5000);
+    jw.setReconnectTimeout(10000);
+    jw.enableSTA(false);
+    jw.loop();
+
+    uint32_t longest = 0;
+    test::messages().clear();
+    uint32_t kept = outage(capture, true, longest);
+
+    // Only the scans, never longer than one of them
+    CHECK(kept > 0);
+    CHECK(longest <= 2000);
+    CHECK_EQUAL(0, test::count(seen, MESSAGE_ACCESSPOINT_CHANNEL_CHANGE));
+    CHECK_EQUAL(1, test::count(seen, MESSAGE_ACCESSPOINT_CREATED));
+
+    uint32_t moved = outage(capture, false, longest);
+    CHECK(moved > 2 * kept);
+
+    return test::result("softap");
+
+}
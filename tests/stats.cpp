@@ -0,0 +1,84 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Reliability counters: failed attempts are not disconnections, SDK reconnects are attempts
+
+#include "test.h"
+
+namespace {
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 300, WL_NO_SSID_AVAIL)
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 500, WL_CONNECTED)
+        .add(INPUT_STATUS, 10000, WL_CONNECTION_LOST)
+        .add(INPUT_STATUS, 12000, WL_CONNECTED);
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.enableAPFallback(false);
+    jw.enableScan(false);
+    jw.setConnectTimeout(1000);
+    jw.setReconnectTimeout(5000);
+    jw.addNetwork("home", "password");
+    capture.load();
+
+    // First attempt fails, the second one connects after the reconnect timeout
+    CHECK(justwifi::replay::run(jw, 10, 10000) > 0);
+    auto stats = jw.getNetwork(0).stats();
+    CHECK_EQUAL(2, stats.attempts);
+    CHECK_EQUAL(1, stats.successes);
+    CHECK_EQUAL(0, stats.disconnects);
+    CHECK_EQUAL(1, stats.reasons[JustWifi::reasonIndex(201)]);
+
+    // Link drops, SDK gets it back before our own reconnect is due
+    jw.setReconnectTimeout(60000);
+    jw.resetReconnectTimeout();
+    test::messages().clear();
+    steps(12000);
+    CHECK(jw.connected());
+    CHECK_EQUAL(1, test::count(test::messages(), MESSAGE_DISCONNECTED));
+    CHECK_EQUAL(0, test::count(test::messages(), MESSAGE_CONNECTING));
+
+    stats = jw.getNetwork(0).stats();
+    CHECK_EQUAL(3, stats.attempts);
+    CHECK_EQUAL(2, stats.successes);
+    CHECK_EQUAL(1, stats.disconnects);
+    CHECK_EQUAL(1, stats.reasons[JustWifi::reasonIndex(200)]);
+    CHECK_EQUAL(3, stats.history_size);
+    CHECK_EQUAL(0x3, stats.history);
+
+    return test::result("stats");
+
+}
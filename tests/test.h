@@ -0,0 +1,114 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Host tests, built against the replay backend. See Makefile
+
+#ifndef JustWifiTest_h
+#define JustWifiTest_h
+
+#include <JustWifiReplay.h>
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+namespace test {
+
+static int failures = 0;
+
+// Capture built in code, in the same format JustWifi::setRecorder() produces
+struct Capture {
+
+    Capture& add(uint8_t type, uint32_t time, uint8_t value, const char* ssid = "", int8_t rssi = 0, uint8_t channel = 0) {
+        justwifi_input_t input {};
+        input.time = time;
+        input.type = type;
+        input.value = value;
+        input.rssi = rssi;
+        input.channel = channel;
+        input.security = ENC_TYPE_CCMP;
+        input.bssid[5] = channel;
+        strncpy(input.ssid, ssid, sizeof(input.ssid) - 1);
+        inputs.push_back(input);
+        return *this;
+    }
+
+    void load() {
+        justwifi::replay::load(inputs.data(), inputs.size());
+    }
+
+    std::vector<justwifi_input_t> inputs;
+
+};
+
+// States in the order they were entered, from the trace
+inline std::vector<uint8_t> states(JustWifi& instance) {
+    static std::vector<uint8_t> result;
+    result.clear();
+    instance.traceEach([](const justwifi_trace_t& record) {
+        if (record.state != record.next_state) result.push_back(record.next_state);
+    });
+    return result;
+}
+
+// Messages in the order they were sent, see subscribe()
+inline std::vector<uint8_t>& messages() {
+    static std::vector<uint8_t> result;
+    return result;
+}
+
+inline void onMessage(justwifi_messages_t message, char*) {
+    if ((MESSAGE_CONNECT_WAITING == message) || (MESSAGE_COMMAND_DONE == message)) return;
+    messages().push_back(message);
+}
+
+inline size_t count(const std::vector<uint8_t>& values, uint8_t value) {
+    size_t result = 0;
+    for (auto current : values) {
+        if (current == value) ++result;
+    }
+    return result;
+}
+
+inline int result(const char* name) {
+    printf("%s: %s\n", name, failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
+
+} // namespace test
+
+#define CHECK(EXPR) do { \
+    if (!(EXPR)) { \
+        ++test::failures; \
+        printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #EXPR); \
+    } \
+} while (0)
+
+#define CHECK_EQUAL(EXPECTED, ACTUAL) do { \
+    long long _expected = static_cast<long long>(EXPECTED); \
+    long long _actual = static_cast<long long>(ACTUAL); \
+    if (_expected != _actual) { \
+        ++test::failures; \
+        printf("%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #ACTUAL, _actual, _expected); \
+    } \
+} while (0)
+
+#endif
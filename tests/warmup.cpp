@@ -0,0 +1,110 @@
+/*
+
+JustWifi, Wifi Manager for ESP8266
+
+Copyright (C) 2016-2018 by Xose Pérez <xose dot perez at gmail dot com>
+
+The JustWifi library is free software: you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+The JustWifi library is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License
+along with the JustWifi library.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+// Warm-up lookups against recorded answers: a fast one, one that never answers in time and one
+// that fails. Ready is sent once all of them are done, and never when the link drops meanwhile
+
+#include "test.h"
+
+#include <algorithm>
+#include <string>
+
+namespace {
+
+std::string ready;
+std::vector<justwifi_input_t> lookups;
+
+void onReady(justwifi_messages_t message, char* parameter) {
+    if (MESSAGE_NETWORK_READY == message) ready = parameter;
+}
+
+void record(const justwifi_input_t& input) {
+    if (INPUT_RESOLVE == input.type) lookups.push_back(input);
+}
+
+void steps(uint32_t ms) {
+    for (uint32_t elapsed = 0; elapsed < ms; elapsed += 10) {
+        justwifi::replay::advance(10);
+        jw.loop();
+    }
+}
+
+} // namespace
+
+int main() {
+
+    test::Capture capture;
+    capture
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 200, WL_CONNECTED)
+        .add(INPUT_RESOLVE, 150, 1, "fast.example.com")
+        .add(INPUT_RESOLVE, 5000, 1, "slow.example.com")
+        .add(INPUT_RESOLVE, 50, 0, "missing.example.com")
+        .add(INPUT_CONNECT, 0, WL_DISCONNECTED, "home", -60, 6)
+        .add(INPUT_STATUS, 200, WL_CONNECTED)
+        .add(INPUT_STATUS, 1000, WL_CONNECTION_LOST);
+
+    static const char* const hosts[] { "fast.example.com", "slow.example.com", "missing.example.com" };
+
+    jw.begin();
+    jw.subscribe(test::onMessage);
+    jw.subscribe(onReady);
+    jw.setRecorder(record);
+    jw.enableAPFallback(false);
+    jw.enableScan(false);
+    jw.setReconnectTimeout(60000);
+    jw.setWarmup(hosts, 3, "pool.ntp.org");
+    jw.addNetwork("home", "password");
+    capture.load();
+
+    CHECK(justwifi::replay::run(jw, 10, 1000) > 0);
+    steps(3000);
+
+    // Slow one is given up after JUSTWIFI_WARMUP_TIMEOUT
+    CHECK_EQUAL(1, test::count(test::messages(), MESSAGE_NETWORK_READY));
+    CHECK(ready.find("RESOLVED: 1/3") != std::string::npos);
+    CHECK(jw.getReadyTime() >= 150 + JUSTWIFI_WARMUP_TIMEOUT + 50);
+    CHECK(jw.getReadyTime() <= 150 + JUSTWIFI_WARMUP_TIMEOUT + 50 + 100);
+
+    CHECK_EQUAL(3, lookups.size());
+    if (3 == lookups.size()) {
+        CHECK_EQUAL(1, lookups[0].value);
+        CHECK_EQUAL(0, lookups[1].value);
+        CHECK(lookups[1].time >= JUSTWIFI_WARMUP_TIMEOUT);
+        CHECK_EQUAL(0, lookups[2].value);
+    }
+
+    // Link drops in the middle of the slow lookup, the next attempt starts without ready
+    jw.disconnect();
+    steps(100);
+    test::messages().clear();
+    steps(1500);
+
+    const std::vector<uint8_t> dropped {
+        MESSAGE_CONNECTED, MESSAGE_DISCONNECTED, MESSAGE_CONNECTING
+    };
+    auto& messages = test::messages();
+    CHECK((messages.size() >= dropped.size()) && std::equal(dropped.begin(), dropped.end(), messages.begin()));
+    CHECK_EQUAL(0, test::count(messages, MESSAGE_NETWORK_READY));
+
+    return test::result("warmup");
+
+}
@@ -0,0 +1,202 @@
+#!/usr/bin/env python
+"""
+
+Decodes the JustWifi state trace (see JustWifi::traceDump() and justwifi_trace_t)
+
+Reads traceDump() output, e.g. a serial log where the lines may be prefixed
+by something else, or traceDumpRaw() output (--binary: head and count of the
+ring buffer, then its JUSTWIFI_TRACE_SIZE justwifi_trace_t records as is).
+State, message and status names are taken from the library headers, so they
+always match the sources the firmware was built from.
+
+    python tools/trace_decode.py serial.log
+    python tools/trace_decode.py --json < serial.log
+    python tools/trace_decode.py --binary trace.bin
+
+"""
+
+import argparse
+import json
+import os
+import re
+import struct
+import sys
+
+SOURCES = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "src")
+
+# JUSTWIFI_TRACE_NO_MESSAGE / JUSTWIFI_TRACE_NO_NETWORK
+NO_MESSAGE = 0xFF
+NO_NETWORK = 0xFF
+
+# traceDump() line, "%10u %2u>%2u MSG: %3u NET: %3u RSSI: %4d STATUS: %3u"
+LINE = re.compile(
+    r"(?P<timestamp>\d+)\s+(?P<state>\d+)>\s*(?P<next_state>\d+)"
+    r"\s+MSG:\s*(?P<message>\d+)\s+NET:\s*(?P<network>\d+)"
+    r"\s+RSSI:\s*(?P<rssi>-?\d+)\s+STATUS:\s*(?P<status>\d+)"
+)
+
+# traceDumpRaw() head and count, then justwifi_trace_t records.
+# Little-endian, records are padded to the alignment of the timestamp
+HEADER = struct.Struct("<II")
+RECORD = struct.Struct("<IBBBBbB2x")
+
+# Messages where 'status' is a wl_status_t or a channel, see the _trace() calls.
+# Records without a message are state changes and have the WiFi mode instead
+STATUS_MESSAGES = (
+    "MESSAGE_CONNECTING",
+    "MESSAGE_CONNECT_WAITING",
+    "MESSAGE_CONNECT_FAILED",
+    "MESSAGE_CONNECTED",
+)
+CHANNEL_MESSAGES = ("MESSAGE_CHANNEL_CHANGE", "MESSAGE_ACCESSPOINT_CHANNEL_CHANGE")
+
+
+def enum(text, name):
+    """Values of 'typedef enum { ... } name;' as a {value: identifier} dict"""
+    match = re.search(r"typedef\s+enum\s*{([^}]*)}\s*" + name + r"\s*;", text)
+    if not match:
+        raise ValueError("{} not found".format(name))
+
+    result = {}
+    value = 0
+    body = re.sub(r"//[^\n]*", "", match.group(1))
+    for entry in body.split(","):
+        entry = entry.strip()
+        if not entry:
+            continue
+        identifier, _, explicit = entry.partition("=")
+        if explicit.strip():
+            value = int(explicit.strip(), 0)
+        result[value] = identifier.strip()
+        value += 1
+
+    return result
+
+
+def names(sources):
+    with open(os.path.join(sources, "JustWifi.h")) as f:
+        header = f.read()
+    with open(os.path.join(sources, "JustWifiBackend.h")) as f:
+        backend = f.read()
+
+    return {
+        "states": enum(header, "justwifi_states_t"),
+        "messages": enum(header, "justwifi_messages_t"),
+        "status": enum(backend, "wl_status_t"),
+        "modes": enum(backend, "WiFiMode_t"),
+    }
+
+
+def text_records(stream):
+    for line in stream:
+        match = LINE.search(line)
+        if match:
+            yield {key: int(value) for key, value in match.groupdict().items()}
+
+
+def binary_records(data):
+    if len(data) < HEADER.size:
+        raise ValueError("traceDumpRaw() header is missing")
+    head, count = HEADER.unpack_from(data)
+
+    size = (len(data) - HEADER.size) // RECORD.size
+    if not size or (head >= size) or (count > size):
+        raise ValueError("head {} and count {} don't fit {} records".format(head, count, size))
+
+    # Same walk as traceEach(), from the oldest record
+    records = []
+    index = (head + size - count) % size
+    for _ in range(count):
+        timestamp, state, next_state, message, network, rssi, status = \
+            RECORD.unpack_from(data, HEADER.size + index * RECORD.size)
+        records.append({
+            "timestamp": timestamp,
+            "state": state,
+            "next_state": next_state,
+            "message": message,
+            "network": network,
+            "rssi": rssi,
+            "status": status,
+        })
+        index = (index + 1) % size
+
+    return records
+
+
+def decode(record, known):
+    result = dict(record)
+
+    result["state"] = known["states"].get(record["state"], record["state"])
+    result["next_state"] = known["states"].get(record["next_state"], record["next_state"])
+
+    message = known["messages"].get(record["message"], record["message"])
+    if record["message"] == NO_MESSAGE:
+        message = None
+        result["status"] = known["modes"].get(record["status"], record["status"])
+    elif message in STATUS_MESSAGES:
+        result["status"] = known["status"].get(record["status"], record["status"])
+    elif message in CHANNEL_MESSAGES:
+        result["channel"] = result.pop("status")
+    result["message"] = message
+
+    if record["network"] == NO_NETWORK:
+        result["network"] = None
+
+    return result
+
+
+def line(record, previous):
+    delta = record["timestamp"] - previous if previous is not None else 0
+    if record["message"] is None:
+        what = "{} -> {}".format(record["state"], record["next_state"])
+    else:
+        what = record["message"]
+
+    details = []
+    if record["network"] is not None:
+        details.append("network {}".format(record["network"]))
+    if record["rssi"]:
+        details.append("{} dBm".format(record["rssi"]))
+    if "channel" in record:
+        details.append("channel {}".format(record["channel"]))
+    else:
+        details.append(str(record["status"]))
+
+    return "{:10} {:+7} {} ({})".format(record["timestamp"], delta, what, ", ".join(details))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decodes the JustWifi state trace")
+    parser.add_argument("input", nargs="?", help="traceDump() output or the raw buffer, stdin by default")
+    parser.add_argument("--binary", action="store_true", help="input is traceDumpRaw() output")
+    parser.add_argument("--json", action="store_true", help="one JSON object per record")
+    parser.add_argument("--sources", default=SOURCES, help="directory with JustWifi.h and JustWifiBackend.h")
+    args = parser.parse_args()
+
+    known = names(args.sources)
+
+    if args.binary:
+        if args.input:
+            with open(args.input, "rb") as f:
+                data = f.read()
+        else:
+            data = getattr(sys.stdin, "buffer", sys.stdin).read()
+        records = binary_records(data)
+    else:
+        stream = open(args.input) if args.input else sys.stdin
+        records = list(text_records(stream))
+
+    previous = None
+    for record in records:
+        decoded = decode(record, known)
+        if args.json:
+            print(json.dumps(decoded, sort_keys=True))
+        else:
+            print(line(decoded, previous))
+        previous = record["timestamp"]
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())